@@ -1,2 +1,22 @@
 import libpy  # noqa
-from .parser import load, loads, Parser, Object, Array, __simdjson_version__  # noqa
+from .parser import (  # noqa
+    load,
+    loads,
+    dumps,
+    minify,
+    validate,
+    stats,
+    reset_stats,
+    collect_stats,
+    shrink_default_parsers,
+    implementations,
+    active_implementation,
+    set_implementation,
+    Parser,
+    ParserPool,
+    PaddedBuffer,
+    Pointer,
+    Object,
+    Array,
+    __simdjson_version__,
+)
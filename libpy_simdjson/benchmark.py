@@ -0,0 +1,64 @@
+"""Time parsing, conversion and lookup in C++, without the interpreter's call overhead.
+
+Usage:
+    python -m libpy_simdjson.benchmark [--min-time SECONDS] [--operation OP]
+                                       [--implementation NAME] [--json] [PATH ...]
+
+This runs the ``native_benchmark`` executable installed next to the extension. With
+no paths, every fixture in ``libpy_simdjson/tests/jsonexamples`` is used; the
+fixtures are not installed, so this only works from a source checkout.
+
+The executable is built with the extension unless ``LIBPY_SIMDJSON_NATIVE_BENCHMARK=0``
+is set at build time. It runs in its own process, so the simdjson implementation it
+uses is picked with ``--implementation``, not ``libpy_simdjson.set_implementation``.
+"""
+import subprocess
+import sys
+from pathlib import Path
+
+EXECUTABLE = Path(__file__).parent / "native_benchmark"
+JSON_FIXTURES_DIR = Path(__file__).parent / "tests" / "jsonexamples"
+
+# options of ``native_benchmark`` followed by a value
+_OPTIONS_WITH_VALUES = {"--min-time", "--operation", "--implementation"}
+# options of ``native_benchmark`` that do not run any benchmarks
+_OPTIONS_WITHOUT_PATHS = {"--list-operations", "-h", "--help"}
+
+
+def main(argv=None):
+    """Run the native benchmarks, returning the executable's exit status."""
+    if argv is None:
+        argv = sys.argv[1:]
+    argv = [str(arg) for arg in argv]
+
+    if not EXECUTABLE.exists():
+        print(
+            f"{EXECUTABLE} does not exist; libpy_simdjson was built without its "
+            "native benchmarks, or with LIBPY_SIMDJSON_NATIVE_BENCHMARK=0",
+            file=sys.stderr,
+        )
+        return 1
+
+    needs_fixtures = True
+    args = iter(argv)
+    for arg in args:
+        if arg in _OPTIONS_WITH_VALUES:
+            next(args, None)
+        elif arg in _OPTIONS_WITHOUT_PATHS or not arg.startswith("-"):
+            needs_fixtures = False
+    if needs_fixtures:
+        fixtures = sorted(JSON_FIXTURES_DIR.glob("*.json"))
+        if not fixtures:
+            print(
+                f"no paths given and no fixtures in {JSON_FIXTURES_DIR}; the "
+                "fixtures are only available in a source checkout",
+                file=sys.stderr,
+            )
+            return 2
+        argv += [str(path) for path in fixtures]
+
+    return subprocess.call([str(EXECUTABLE)] + argv)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,513 @@
+// The out-of-line definitions for ``parser.h``, compiled once and linked into both the
+// extension and the ``native_benchmark`` executable.
+#include "parser.h"
+
+namespace libpy_simdjson {
+std::unique_lock<std::mutex> parser::lock_for_parse() {
+    if (m_streaming) {
+        throw py::exception(PyExc_ValueError,
+                            "cannot parse while a DocumentStream is using this parser");
+    }
+    return try_lock_parser();
+}
+
+std::unique_lock<std::mutex> parser::try_lock_parser() {
+    std::unique_lock<std::mutex> lock(m_parse_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        throw py::exception(PyExc_ValueError,
+                            "cannot parse while another thread is using this parser");
+    }
+    return lock;
+}
+
+int parser::parse_file(const std::string& path,
+                       simdjson::error_code& error,
+                       bool keep_mapped) {
+    if (!m_mapped_file.is_current(path)) {
+        int err;
+        try {
+            err = m_mapped_file.open(path);
+        }
+        catch (const std::bad_alloc&) {
+            // this may run on a ``parser_pool`` worker, where nothing may throw
+            err = ENOMEM;
+        }
+        if (err) {
+            error = simdjson::IO_ERROR;
+            return err;
+        }
+    }
+    // the mapping is padded with zeros to a page boundary
+    error = parse_input(m_mapped_file.data(), m_mapped_file.size(), false);
+    if (!keep_mapped) {
+        m_mapped_file.close();
+    }
+    return 0;
+}
+
+simdjson::error_code parser::parse_buffer(const input_buffer& in_buffer) {
+    // only copy the input when there is no room for simdjson's padding
+    return parse_input(in_buffer.data(), in_buffer.size(), !in_buffer.padded());
+}
+
+simdjson::error_code parser::reallocate(std::size_t capacity, std::size_t max_depth) {
+    bool replace = m_kernel != simdjson::active_implementation;
+    if (replace) {
+        // stage 1 state is laid out for one kernel, so it cannot be reused by another
+        m_parser.implementation.reset();
+    }
+    // ``dom::parser::allocate`` only replaces the document when the capacity changes
+    bool new_document = replace || !m_parser.doc.tape || capacity != m_parser.capacity();
+    auto error = m_parser.allocate(capacity, max_depth);
+    if (error) {
+        return error;
+    }
+    if (replace) {
+        // read after allocating: the first allocation swaps the placeholder that
+        // detects the CPU for the implementation it picked
+        m_kernel = simdjson::active_implementation;
+    }
+    if (new_document) {
+        m_document_capacity = capacity;
+    }
+    return error;
+}
+
+simdjson::error_code parser::ensure_capacity(std::size_t size) {
+    if (size > m_parser.capacity() || !m_parser.doc.tape ||
+        m_kernel != simdjson::active_implementation) {
+        if (size > m_parser.max_capacity()) {
+            return simdjson::CAPACITY;
+        }
+        // keep any capacity reserved with ``allocate`` when switching implementations
+        return reallocate(std::max(size, m_parser.capacity()), m_parser.max_depth());
+    }
+    return simdjson::SUCCESS;
+}
+
+simdjson::error_code
+parser::parse_input(const char* data, std::size_t size, bool copy) {
+    // this is ``dom::parser::parse`` split up so that each step can be timed
+    if (auto error = ensure_capacity(size)) {
+        return error;
+    }
+    m_parsed_size = size;
+
+    bool collect = collect_stats();
+    parse_stats::stopwatch watch(collect);
+    std::unique_ptr<char[]> padded;
+    if (copy) {
+        padded.reset(simdjson::internal::allocate_padded_buffer(size));
+        if (!padded) {
+            return simdjson::MEMALLOC;
+        }
+        std::memcpy(padded.get(), data, size);
+        data = padded.get();
+    }
+    parse_stats::sample values{};
+    values[parse_stats::copy_ns] = watch.lap();
+
+    auto& impl = *m_parser.implementation;
+    auto error = impl.stage1(reinterpret_cast<const std::uint8_t*>(data), size, false);
+    values[parse_stats::stage1_ns] = watch.lap();
+    if (!error) {
+        error = impl.stage2(m_parser.doc);
+        values[parse_stats::stage2_ns] = watch.lap();
+    }
+
+    if (parse_stats::supported && collect) {
+        if (!error) {
+            parse_stats::describe_document(values, size, impl, m_parser.doc);
+        }
+        m_stats.add(values);
+        global_stats.add(values);
+    }
+    return error;
+}
+
+simdjson::error_code parser::scan_buffer(const input_buffer& in_buffer) {
+    // stage 1 copies the last partial block itself, so the input needs no padding
+    if (auto error = ensure_capacity(in_buffer.size())) {
+        return error;
+    }
+    return m_parser.implementation->stage1(reinterpret_cast<const std::uint8_t*>(
+                                               in_buffer.data()),
+                                           in_buffer.size(),
+                                           false);
+}
+
+parser::validation parser::validate(const input_buffer& in_buffer, bool structural_only) {
+    auto lock = lock_for_parse();
+    validation out;
+    // ``in_buffer`` pins the argument object, so its memory stays valid without the GIL
+    py::gil::release_block released;
+    if (structural_only) {
+        out.error = scan_buffer(in_buffer);
+        return out;
+    }
+    out.error = parse_buffer(in_buffer);
+    // simdjson does not record where stage 2 failed, except when a whole document was
+    // followed by more content: ``next_structural_index``, which stage 1 sets to 0, is
+    // then the first structural index after the document
+    const auto& impl = *m_parser.implementation;
+    if (out.error == simdjson::TAPE_ERROR && impl.next_structural_index > 0 &&
+        impl.next_structural_index < impl.n_structural_indexes) {
+        out.offset = impl.structural_indexes[impl.next_structural_index];
+    }
+    return out;
+}
+
+py::owned_ref<> parser::validation::to_object() const {
+    py::owned_ref<> out{PyTuple_New(3)};
+    if (!out) {
+        throw py::exception{};
+    }
+    py::owned_ref<> code = py::owned_ref<>::new_reference(Py_None);
+    py::owned_ref<> message = py::owned_ref<>::new_reference(Py_None);
+    if (error) {
+        code = py::owned_ref<>{PyUnicode_FromString(error_code_name(error))};
+        message = py::owned_ref<>{PyUnicode_FromString(simdjson::error_message(error))};
+        if (!code || !message) {
+            throw py::exception{};
+        }
+    }
+    py::owned_ref<> where = offset ? py::to_object(*offset)
+                                   : py::owned_ref<>::new_reference(Py_None);
+    PyTuple_SET_ITEM(out.get(), 0, std::move(code).escape());
+    PyTuple_SET_ITEM(out.get(), 1, std::move(message).escape());
+    PyTuple_SET_ITEM(out.get(), 2, std::move(where).escape());
+    return out;
+}
+
+void parser::set_max_capacity(std::size_t max_capacity) {
+    if (max_capacity > simdjson::SIMDJSON_MAXSIZE_BYTES) {
+        throw py::exception(PyExc_ValueError,
+                            "max_capacity may be at most ",
+                            simdjson::SIMDJSON_MAXSIZE_BYTES,
+                            ", got ",
+                            max_capacity);
+    }
+    auto lock = lock_for_parse();
+    m_parser.set_max_capacity(max_capacity);
+}
+
+void parser::allocate(std::size_t capacity, std::size_t max_depth) {
+    if (capacity > m_parser.max_capacity()) {
+        throw py::exception(PyExc_ValueError,
+                            "capacity ",
+                            capacity,
+                            " exceeds the parser's max_capacity of ",
+                            m_parser.max_capacity());
+    }
+    if (max_depth == 0) {
+        throw py::exception(PyExc_ValueError, "max_depth must be at least 1");
+    }
+    auto lock = lock_for_parse();
+    simdjson::error_code error;
+    {
+        py::gil::release_block released;
+        error = reallocate(capacity, max_depth);
+    }
+    if (error) {
+        throw py::exception(PyExc_MemoryError, simdjson::error_message(error));
+    }
+}
+
+void parser::shrink(std::size_t capacity) {
+    auto lock = lock_for_parse();
+    {
+        std::lock_guard<std::mutex> guard(m_spare_mutex);
+        if (m_spare_capacity > capacity) {
+            m_spare_document = simdjson::dom::document{};
+            m_spare_capacity = 0;
+        }
+        m_spare_limit = capacity;
+    }
+    m_mapped_file.close();
+    if (m_parser.capacity() > capacity && reallocate(capacity, m_parser.max_depth())) {
+        throw py::exception(PyExc_MemoryError, "failed to reallocate the parser");
+    }
+}
+
+py::owned_ref<> parser::memory_usage() {
+    auto lock = lock_for_parse();
+    std::size_t capacity = m_parser.capacity();
+    std::size_t parser_bytes =
+        m_parser.implementation
+            ? buffer_sizes::parser_bytes(capacity, m_parser.max_depth())
+            : 0;
+    std::size_t document_bytes =
+        m_parser.doc.tape
+            ? buffer_sizes::document_bytes(std::max(m_document_capacity, capacity))
+            : 0;
+    std::size_t spare_bytes;
+    {
+        std::lock_guard<std::mutex> guard(m_spare_mutex);
+        spare_bytes = m_spare_document.tape
+                          ? buffer_sizes::document_bytes(m_spare_capacity)
+                          : 0;
+    }
+
+    py::owned_ref<> out{PyDict_New()};
+    if (!out) {
+        throw py::exception{};
+    }
+    std::pair<const char*, std::size_t> fields[] = {
+        {"capacity", capacity},
+        // stage 1's structural indexes and stage 2's stacks
+        {"parser_bytes", parser_bytes},
+        // the tape and string buffer the next document is parsed into
+        {"document_bytes", document_bytes},
+        // a released document's buffers, kept to be swapped in at the next parse
+        {"spare_bytes", spare_bytes},
+        // what the parser holds on to once every result has been dropped
+        {"retained_bytes", parser_bytes + document_bytes + spare_bytes},
+        // the buffers of documents still referred to by an ``Object`` or ``Array``
+        {"live_document_bytes", m_live_document_bytes.load()},
+        // the file kept mapped by ``load(..., keep_mapped=True)``
+        {"mapped_bytes", m_mapped_file.size()},
+    };
+    for (const auto& [key, value] : fields) {
+        if (PyDict_SetItemString(out.get(), key, py::to_object(value).get())) {
+            throw py::exception{};
+        }
+    }
+    return out;
+}
+
+std::shared_ptr<detached_document> parser::detach_document() {
+    std::size_t capacity = m_parser.capacity();
+    // below this share of the capacity, the few bytes the document uses are cheaper to
+    // copy than the buffers are to keep
+    constexpr std::size_t compact_below = 4;
+    if (m_streaming || m_parsed_size * compact_below <= capacity) {
+        simdjson::dom::document compact;
+        std::size_t bytes;
+        if (copy_document(m_parser.doc, compact, bytes)) {
+            return nullptr;
+        }
+        auto out = std::make_shared<detached_document>(shared_from_this(), 0, bytes);
+        out->document = std::move(compact);
+        return out;
+    }
+
+    simdjson::dom::document replacement;
+    std::size_t replacement_capacity = capacity;
+    {
+        std::lock_guard<std::mutex> guard(m_spare_mutex);
+        m_spare_limit = std::max(m_spare_limit, capacity);
+        if (m_spare_document.tape && m_spare_capacity >= capacity) {
+            replacement = std::move(m_spare_document);
+            replacement_capacity = m_spare_capacity;
+        }
+    }
+    if (!replacement.tape && allocate_document(replacement, capacity)) {
+        return nullptr;
+    }
+
+    // ``dom::parser`` may have grown the document on its own, but never shrinks it
+    auto out = std::make_shared<detached_document>(shared_from_this(),
+                                                   std::max(m_document_capacity,
+                                                            capacity));
+    out->document = std::move(m_parser.doc);
+    m_parser.doc = std::move(replacement);
+    m_document_capacity = replacement_capacity;
+    return out;
+}
+
+void parser::recycle_document(simdjson::dom::document&& doc, std::size_t capacity) {
+    std::lock_guard<std::mutex> guard(m_spare_mutex);
+    if (capacity <= m_spare_limit &&
+        (!m_spare_document.tape || m_spare_capacity < capacity)) {
+        m_spare_document = std::move(doc);
+        m_spare_capacity = capacity;
+    }
+}
+
+py::owned_ref<> parser::load(const std::filesystem::path& filename, bool keep_mapped) {
+    auto lock = lock_for_parse();
+    std::string path = filename.string();
+    simdjson::error_code error;
+    int err;
+    {
+        // stage 1 and stage 2 never touch Python objects; ``path`` is owned by this
+        // frame so nothing needs to be pinned.
+        py::gil::release_block released;
+        err = parse_file(path, error, keep_mapped);
+    }
+    if (err) {
+        throw_io_error(path, err);
+    }
+    if (error) {
+        throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+    }
+    return detach_result();
+}
+
+py::owned_ref<> parser::loads(const input_buffer& in_buffer) {
+    auto lock = lock_for_parse();
+    simdjson::error_code error;
+    {
+        // ``in_buffer`` pins the argument object, so its memory stays valid without
+        // the GIL.
+        py::gil::release_block released;
+        error = parse_buffer(in_buffer);
+    }
+    if (error) {
+        throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+    }
+    return detach_result();
+}
+
+py::owned_ref<> parser::detach_result() {
+    simdjson::dom::element root = m_parser.doc.root();
+    if (root.type() != simdjson::dom::element_type::ARRAY &&
+        root.type() != simdjson::dom::element_type::OBJECT) {
+        // scalars are converted immediately and never refer back to the document
+        return timed_conversion([&] { return scalar_to_object(root, m_decode_strings); });
+    }
+
+    auto doc = detach_document();
+    if (!doc) {
+        throw py::exception(PyExc_MemoryError, "failed to allocate a document");
+    }
+    return timed_conversion([&] { return disambiguate_detached(doc); });
+}
+
+py::owned_ref<> parser::load_many(const std::filesystem::path& filename,
+                                  std::size_t batch_size) {
+    auto lock = lock_for_parse();
+    return py::autoclass<document_stream>::construct(shared_from_this(),
+                                                     filename.string(),
+                                                     batch_size);
+}
+
+py::owned_ref<> parser::parse_many(input_buffer&& in_buffer, std::size_t batch_size) {
+    auto lock = lock_for_parse();
+    return py::autoclass<document_stream>::construct(shared_from_this(),
+                                                     std::move(in_buffer),
+                                                     batch_size);
+}
+
+py::owned_ref<> object_element::operator[](py::borrowed_ref<> field) {
+    return disambiguate_result(m_document, m_document->find(m_value, text_view(field)));
+}
+
+py::owned_ref<> object_element::at_pointer(py::borrowed_ref<> json_pntr) {
+    simdjson::dom::element result;
+    auto maybe_result = resolve_pointer(json_pntr, m_value);
+    auto error = maybe_result.get(result);
+    if (error) {
+        throw py::exception(PyExc_KeyError, pointer_text(json_pntr));
+    }
+    return disambiguate_result(m_document, result);
+}
+
+py::owned_ref<> array_element::at_pointer(py::borrowed_ref<> json_pntr) {
+    simdjson::dom::element result;
+    auto maybe_result = resolve_pointer(json_pntr, m_value);
+    auto error = maybe_result.get(result);
+    if (error) {
+        throw py::exception(PyExc_IndexError, pointer_text(json_pntr));
+    }
+    return disambiguate_result(m_document, result);
+}
+
+/** Resolve every pointer in ``json_pntrs`` against ``value`` in one pass.
+
+    @param missing_error The exception to raise for a pointer that names nothing when
+           there is no default.
+    @return A tuple with one entry per pointer.
+ */
+template<typename T>
+py::owned_ref<> extract_pointers(const std::shared_ptr<detached_document>& doc,
+                                 T value,
+                                 py::borrowed_ref<> json_pntrs,
+                                 const std::optional<py::borrowed_ref<>>& default_value,
+                                 PyObject* missing_error) {
+    std::vector<py::owned_ref<>> items = to_vector(json_pntrs);
+    // pointers given as text are compiled here; ``reserve`` keeps them from moving
+    std::vector<json_pointer> compiled;
+    compiled.reserve(items.size());
+    std::vector<const json_pointer*> pointers;
+    pointers.reserve(items.size());
+    for (const py::owned_ref<>& item : items) {
+        if (is_pointer(item)) {
+            pointers.push_back(&py::autoclass<json_pointer>::unbox(item));
+        }
+        else {
+            pointers.push_back(&compiled.emplace_back(make_pointer(item)));
+        }
+    }
+
+    auto results = pointer_trie{pointers}.resolve(value);
+
+    py::owned_ref<> out{PyTuple_New(results.size())};
+    if (!out) {
+        throw py::exception{};
+    }
+    for (std::size_t ix = 0; ix < results.size(); ++ix) {
+        py::owned_ref<> item;
+        if (results[ix]) {
+            item = disambiguate_result(doc, *results[ix]);
+        }
+        else if (default_value) {
+            item = py::owned_ref<>::new_reference(default_value->get());
+        }
+        else {
+            throw py::exception(missing_error, pointers[ix]->text());
+        }
+        PyTuple_SET_ITEM(out.get(), ix, std::move(item).escape());
+    }
+    return out;
+}
+
+py::owned_ref<> object_element::extract(py::borrowed_ref<> json_pntrs,
+                                        default_arg default_value) {
+    return extract_pointers(m_document,
+                            m_value,
+                            json_pntrs,
+                            default_value.get(),
+                            PyExc_KeyError);
+}
+
+py::owned_ref<> array_element::extract(py::borrowed_ref<> json_pntrs,
+                                       default_arg default_value) {
+    return extract_pointers(m_document,
+                            m_value,
+                            json_pntrs,
+                            default_value.get(),
+                            PyExc_IndexError);
+}
+
+py::owned_ref<> object_element::materialize(depth_arg depth) {
+    if (!depth.get()) {
+        return as_dict();
+    }
+    return m_document->owner->timed_conversion(
+        [&] { return shallow_converter{m_document}(m_value, *depth.get()); });
+}
+
+py::owned_ref<> array_element::materialize(depth_arg depth) {
+    if (!depth.get()) {
+        return as_list();
+    }
+    return m_document->owner->timed_conversion(
+        [&] { return shallow_converter{m_document}(m_value, *depth.get()); });
+}
+
+py::owned_ref<> array_element::operator[](std::ptrdiff_t index) {
+    std::ptrdiff_t original_index = index;
+    if (index < 0) {
+        index += m_value.size();
+    }
+
+    simdjson::dom::element result;
+    auto maybe_result = m_value.at(index);
+    auto error = maybe_result.get(result);
+    if (error) {
+        throw py::exception(PyExc_IndexError, original_index);
+    }
+    return disambiguate_result(m_document, result);
+}
+}  // namespace libpy_simdjson
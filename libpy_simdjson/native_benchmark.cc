@@ -0,0 +1,660 @@
+/** Benchmarks of the C++ side of the bindings, timed in C++ so that the interpreter's
+    own call overhead does not hide the cost of parsing, converting and searching.
+
+    This is the ``native_benchmark`` executable, installed next to the
+    ``libpy_simdjson.parser`` extension. It is linked from the same ``core.cc`` and
+    ``simdjson.cpp`` objects as the extension and embeds the interpreter to build the
+    Python objects that conversions return. Run it directly, or with
+    ``python -m libpy_simdjson.benchmark`` to default to the test fixtures.
+
+    Being a separate process, it picks its simdjson implementation on its own, or uses
+    the one named with ``--implementation``.
+ */
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <new>
+
+#include "parser.h"
+
+namespace libpy_simdjson::native_benchmark {
+namespace {
+/** Counts, while it is alive, the calls into Python's object and memory allocators and
+    into ``operator new``, which C++ uses for the tapes, string buffers and
+    ``object_index`` tables.
+
+    The Python counter wraps the allocators that are installed, like ``tracemalloc``
+    does, so it may be installed after the interpreter has started. ``operator new`` is
+    replaced below to report to ``count_new``.
+ */
+class allocation_counter {
+private:
+    static constexpr PyMemAllocatorDomain domains[] = {PYMEM_DOMAIN_MEM,
+                                                       PYMEM_DOMAIN_OBJ};
+
+    // only touched with the GIL held, which both domains require
+    static inline std::size_t m_python_count = 0;
+
+    // ``operator new`` may run on any thread, e.g. simdjson's stage 1 helper
+    static inline std::atomic<bool> m_counting_new{false};
+    static inline std::atomic<std::size_t> m_cxx_count{0};
+
+    PyMemAllocatorEx m_original[std::size(domains)];
+
+    static void* malloc(void* ctx, std::size_t size) {
+        ++m_python_count;
+        auto* original = static_cast<PyMemAllocatorEx*>(ctx);
+        return original->malloc(original->ctx, size);
+    }
+
+    static void* calloc(void* ctx, std::size_t n_elements, std::size_t element_size) {
+        ++m_python_count;
+        auto* original = static_cast<PyMemAllocatorEx*>(ctx);
+        return original->calloc(original->ctx, n_elements, element_size);
+    }
+
+    static void* realloc(void* ctx, void* ptr, std::size_t size) {
+        ++m_python_count;
+        auto* original = static_cast<PyMemAllocatorEx*>(ctx);
+        return original->realloc(original->ctx, ptr, size);
+    }
+
+    static void free(void* ctx, void* ptr) {
+        auto* original = static_cast<PyMemAllocatorEx*>(ctx);
+        original->free(original->ctx, ptr);
+    }
+
+public:
+    allocation_counter() {
+        m_python_count = 0;
+        for (std::size_t ix = 0; ix < std::size(domains); ++ix) {
+            PyMem_GetAllocator(domains[ix], &m_original[ix]);
+            PyMemAllocatorEx hook{&m_original[ix], malloc, calloc, realloc, free};
+            PyMem_SetAllocator(domains[ix], &hook);
+        }
+        m_cxx_count.store(0);
+        m_counting_new.store(true);
+    }
+
+    allocation_counter(const allocation_counter&) = delete;
+    allocation_counter& operator=(const allocation_counter&) = delete;
+
+    ~allocation_counter() {
+        m_counting_new.store(false);
+        for (std::size_t ix = 0; ix < std::size(domains); ++ix) {
+            PyMem_SetAllocator(domains[ix], &m_original[ix]);
+        }
+    }
+
+    /** Called by every ``operator new``.
+     */
+    static void count_new() {
+        if (m_counting_new.load(std::memory_order_relaxed)) {
+            m_cxx_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::size_t python_count() const {
+        return m_python_count;
+    }
+
+    std::size_t cxx_count() const {
+        return m_cxx_count.load();
+    }
+};
+}  // namespace
+}  // namespace libpy_simdjson::native_benchmark
+
+// The array and ``nothrow`` forms of ``new`` and ``delete`` forward to these.
+void* operator new(std::size_t size) {
+    libpy_simdjson::native_benchmark::allocation_counter::count_new();
+    if (void* out = std::malloc(size ? size : 1)) {
+        return out;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    libpy_simdjson::native_benchmark::allocation_counter::count_new();
+    auto align = static_cast<std::size_t>(alignment);
+    // ``aligned_alloc`` takes a non-zero multiple of the alignment
+    std::size_t rounded = size ? (size + align - 1) / align * align : align;
+    if (void* out = std::aligned_alloc(align, rounded)) {
+        return out;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+namespace libpy_simdjson::native_benchmark {
+namespace {
+/** A document parsed once, with every value in it and the JSON Pointer naming it.
+ */
+struct fixture {
+    simdjson::padded_string text;
+    std::shared_ptr<detached_document> document;
+    simdjson::dom::element root;
+    std::vector<std::pair<std::string, simdjson::dom::element>> values;
+
+    explicit fixture(const std::string& path) {
+        if (auto error = simdjson::padded_string::load(path).get(text)) {
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+        }
+        document = parse();
+        root = document->document.root();
+        std::string pointer;
+        collect(root, pointer);
+    }
+
+    /** Parse ``text`` into a new detached document, which owns its buffers the way the
+        documents behind ``Object`` and ``Array`` do.
+     */
+    std::shared_ptr<detached_document> parse() const {
+        simdjson::dom::parser scratch;
+        if (auto error = scratch.parse(text).error()) {
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+        }
+        auto out = std::make_shared<detached_document>(std::make_shared<parser>(),
+                                                       scratch.capacity());
+        out->document = std::move(scratch.doc);
+        return out;
+    }
+
+private:
+    static void escape_token(std::string& pointer, std::string_view token) {
+        for (char c : token) {
+            if (c == '~') {
+                pointer += "~0";
+            }
+            else if (c == '/') {
+                pointer += "~1";
+            }
+            else {
+                pointer.push_back(c);
+            }
+        }
+    }
+
+    void collect(simdjson::dom::element element, std::string& pointer) {
+        values.emplace_back(pointer, element);
+        std::size_t prefix = pointer.size();
+        switch (element.type()) {
+        case simdjson::dom::element_type::ARRAY: {
+            std::size_t ix = 0;
+            for (simdjson::dom::element value : simdjson::dom::array(element)) {
+                pointer.push_back('/');
+                pointer += std::to_string(ix++);
+                collect(value, pointer);
+                pointer.resize(prefix);
+            }
+            break;
+        }
+        case simdjson::dom::element_type::OBJECT:
+            for (auto [key, value] : simdjson::dom::object(element)) {
+                pointer.push_back('/');
+                escape_token(pointer, key);
+                collect(value, pointer);
+                pointer.resize(prefix);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+/** One benchmarked operation over a fixture.
+ */
+struct operation {
+    // how many values each call processes, or 0 if the fixture has none to process
+    std::size_t items = 0;
+    std::function<void()> run;
+};
+
+void check(bool ok) {
+    if (!ok) {
+        throw py::exception{};
+    }
+}
+
+operation parse(fixture& f) {
+    auto scratch = std::make_shared<simdjson::dom::parser>();
+    if (auto error = scratch->allocate(f.text.size())) {
+        throw py::exception(PyExc_MemoryError, simdjson::error_message(error));
+    }
+    return {1, [&f, scratch] {
+                if (auto error = scratch->parse(f.text).error()) {
+                    throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+                }
+            }};
+}
+
+operation to_object(fixture& f) {
+    // libpy's generic dispatch through the ``py::dispatch::to_object`` specializations
+    return {f.values.size(), [&f] { check(py::to_object(f.root).get()); }};
+}
+
+template<bool decode_strings>
+operation as_py_obj(fixture& f) {
+    // the converter behind ``as_dict`` and ``as_list``
+    return {f.values.size(),
+            [&f] { check(object_converter{decode_strings}(f.root).get()); }};
+}
+
+template<simdjson::dom::element_type type>
+operation scalars(fixture& f) {
+    auto elements = std::make_shared<std::vector<simdjson::dom::element>>();
+    for (const auto& [pointer, element] : f.values) {
+        if (element.type() == type) {
+            elements->push_back(element);
+        }
+    }
+    return {elements->size(), [elements] {
+                for (simdjson::dom::element element : *elements) {
+                    check(scalar_to_object(element, false).get());
+                }
+            }};
+}
+
+operation at_pointer(fixture& f) {
+    auto pointers = std::make_shared<std::vector<json_pointer>>(f.values.size());
+    for (std::size_t ix = 0; ix < f.values.size(); ++ix) {
+        if (auto error = (*pointers)[ix].compile(f.values[ix].first)) {
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+        }
+    }
+    return {pointers->size(), [&f, pointers] {
+                for (const json_pointer& pointer : *pointers) {
+                    if (auto error = pointer.resolve(f.root).error()) {
+                        throw py::exception(PyExc_ValueError,
+                                            simdjson::error_message(error));
+                    }
+                }
+            }};
+}
+
+/** Search every array of scalars for its last element, which ``count`` and ``index``
+    both have to scan the whole array to find.
+ */
+template<bool index>
+operation search(fixture& f) {
+    struct haystack {
+        array_element array;
+        py::owned_ref<> needle;
+    };
+    auto haystacks = std::make_shared<std::vector<haystack>>();
+    std::size_t items = 0;
+    for (const auto& [pointer, element] : f.values) {
+        if (element.type() != simdjson::dom::element_type::ARRAY) {
+            continue;
+        }
+        simdjson::dom::array array(element);
+        bool flat = array.size() && std::all_of(array.begin(), array.end(), [](auto e) {
+            return e.type() != simdjson::dom::element_type::ARRAY &&
+                   e.type() != simdjson::dom::element_type::OBJECT;
+        });
+        if (!flat) {
+            continue;
+        }
+        simdjson::dom::element last = array.at(array.size() - 1).first;
+        haystacks->push_back({array_element{f.document, array},
+                              scalar_to_object(last, false)});
+        items += array.size();
+    }
+    return {items, [haystacks] {
+                for (const auto& [array, needle] : *haystacks) {
+                    if constexpr (index) {
+                        array.index(needle);
+                    }
+                    else {
+                        array.count(needle);
+                    }
+                }
+            }};
+}
+
+/** Compare the document with a second copy of it, the way ``Object`` and ``Array``
+    implement ``==``.
+ */
+operation eq(fixture& f) {
+    bool is_array = f.root.type() == simdjson::dom::element_type::ARRAY;
+    if (!is_array && f.root.type() != simdjson::dom::element_type::OBJECT) {
+        return {};
+    }
+    auto other = f.parse();
+    simdjson::dom::element rhs = other->document.root();
+    return {f.values.size(), [&f, other, rhs, is_array] {
+                bool equal = is_array ? element_eq(simdjson::dom::array(f.root),
+                                                   simdjson::dom::array(rhs))
+                                      : element_eq(simdjson::dom::object(f.root),
+                                                   simdjson::dom::object(rhs));
+                if (!equal) {
+                    throw py::exception(PyExc_AssertionError,
+                                        "a document does not equal itself");
+                }
+            }};
+}
+
+/** Hash the whole document from the tape, the way ``Object`` and ``Array`` implement
+    ``__hash__`` before the result is cached.
+ */
+operation hash(fixture& f) {
+    if (f.root.type() != simdjson::dom::element_type::ARRAY &&
+        f.root.type() != simdjson::dom::element_type::OBJECT) {
+        return {};
+    }
+    std::size_t root = tape_access::index(f.root);
+    std::uint64_t expected = f.document->digest(f.root);
+    return {f.values.size(), [&f, root, expected] {
+                std::size_t ix = root;
+                if (tape_hasher{f.document->document}.element(ix) != expected) {
+                    throw py::exception(PyExc_AssertionError,
+                                        "a document's hash changed");
+                }
+            }};
+}
+
+using element_type = simdjson::dom::element_type;
+
+const std::pair<const char*, operation (*)(fixture&)> registry[] = {
+    {"parse", parse},
+    {"to_object", to_object},
+    {"as_py_obj", as_py_obj<false>},
+    {"as_decoded_py_obj", as_py_obj<true>},
+    {"scalars:string", scalars<element_type::STRING>},
+    {"scalars:int64", scalars<element_type::INT64>},
+    {"scalars:uint64", scalars<element_type::UINT64>},
+    {"scalars:double", scalars<element_type::DOUBLE>},
+    {"scalars:bool", scalars<element_type::BOOL>},
+    {"scalars:null", scalars<element_type::NULL_VALUE>},
+    {"at_pointer", at_pointer},
+    {"count", search<false>},
+    {"index", search<true>},
+    {"eq", eq},
+    {"hash", hash},
+};
+
+using registry_entry = std::pair<const char*, operation (*)(fixture&)>;
+
+const registry_entry* find_operation(std::string_view name) {
+    auto it = std::find_if(std::begin(registry), std::end(registry), [&](const auto& p) {
+        return name == p.first;
+    });
+    return it == std::end(registry) ? nullptr : it;
+}
+
+/** The timing of one operation over one document.
+ */
+struct measurement {
+    std::size_t items;
+    std::size_t iterations;
+    double seconds;
+    double gb_per_s;
+    double ns_per_item;
+    std::size_t python_allocations;
+    std::size_t cxx_allocations;
+};
+
+/** Time ``factory``'s operation over the document at ``path`` for at least
+    ``min_time`` seconds.
+
+    @return The measurement, with the allocations of one call; or nothing if the
+            document has nothing for the operation to process.
+ */
+std::optional<measurement>
+run(const std::string& path, operation (*factory)(fixture&), double min_time) {
+    fixture f{path};
+    operation op = factory(f);
+    if (!op.items) {
+        return std::nullopt;
+    }
+
+    // warm up the caches and any buffers the operation grows, then count the
+    // allocations of one call separately so the hooks do not slow the timed calls
+    op.run();
+    measurement out{};
+    out.items = op.items;
+    {
+        allocation_counter counter;
+        op.run();
+        out.python_allocations = counter.python_count();
+        out.cxx_allocations = counter.cxx_count();
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto deadline = start + std::chrono::duration<double>(min_time);
+    clock::time_point now;
+    do {
+        op.run();
+        ++out.iterations;
+    } while ((now = clock::now()) < deadline);
+    out.seconds = std::chrono::duration<double>(now - start).count();
+    out.gb_per_s = f.text.size() * out.iterations / out.seconds / 1e9;
+    out.ns_per_item = out.seconds * 1e9 / (out.iterations * out.items);
+    return out;
+}
+
+constexpr const char* usage =
+    "usage: native_benchmark [--min-time SECONDS] [--operation OP]...\n"
+    "                        [--implementation NAME] [--json] PATH...\n"
+    "       native_benchmark --list-operations\n";
+
+struct options {
+    std::vector<std::string> paths;
+    std::vector<const registry_entry*> operations;
+    double min_time = 0.2;
+    const char* implementation = nullptr;
+    bool json = false;
+    bool list_operations = false;
+};
+
+/** Parse the command line, or print why it is invalid and return nothing.
+ */
+std::optional<options> parse_args(int argc, char** argv) {
+    options out;
+    auto fail = [](const char* message, std::string_view arg) {
+        std::fprintf(stderr,
+                     "%snative_benchmark: error: %s%.*s\n",
+                     usage,
+                     message,
+                     static_cast<int>(arg.size()),
+                     arg.data());
+        return std::nullopt;
+    };
+    for (int ix = 1; ix < argc; ++ix) {
+        std::string_view arg = argv[ix];
+        bool takes_value = arg == "--min-time" || arg == "--operation" ||
+                           arg == "--implementation";
+        if (takes_value && ix + 1 == argc) {
+            return fail("expected a value after ", arg);
+        }
+
+        if (arg == "--min-time") {
+            char* end;
+            out.min_time = std::strtod(argv[++ix], &end);
+            if (*end || end == argv[ix] || !(out.min_time >= 0)) {
+                return fail("invalid --min-time: ", argv[ix]);
+            }
+        }
+        else if (arg == "--operation") {
+            const registry_entry* entry = find_operation(argv[++ix]);
+            if (!entry) {
+                return fail("unknown operation: ", argv[ix]);
+            }
+            out.operations.push_back(entry);
+        }
+        else if (arg == "--implementation") {
+            out.implementation = argv[++ix];
+        }
+        else if (arg == "--json") {
+            out.json = true;
+        }
+        else if (arg == "--list-operations") {
+            out.list_operations = true;
+        }
+        else if (arg == "-h" || arg == "--help") {
+            std::fputs(usage, stdout);
+            std::exit(0);
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            return fail("unknown option: ", arg);
+        }
+        else {
+            out.paths.emplace_back(arg);
+        }
+    }
+    if (out.paths.empty() && !out.list_operations) {
+        return fail("no paths given", "");
+    }
+    if (out.operations.empty()) {
+        for (const registry_entry& entry : registry) {
+            out.operations.push_back(&entry);
+        }
+    }
+    return out;
+}
+
+void print(const std::string& path,
+           const char* operation_name,
+           const measurement& m,
+           bool json) {
+    if (!json) {
+        std::string name = std::filesystem::path(path).filename().string();
+        std::printf("%-40s %-18s %8.3f %10.1f %11zu %11zu\n",
+                    name.c_str(),
+                    operation_name,
+                    m.gb_per_s,
+                    m.ns_per_item,
+                    m.python_allocations,
+                    m.cxx_allocations);
+        return;
+    }
+
+    json_writer out;
+    out.start_object();
+    out.key("file");
+    out.string(path);
+    out.comma();
+    out.key("operation");
+    out.string(operation_name);
+    for (auto [key, value] : {std::pair{"items", m.items},
+                              std::pair{"iterations", m.iterations},
+                              std::pair{"python_allocations", m.python_allocations},
+                              std::pair{"cxx_allocations", m.cxx_allocations}}) {
+        out.comma();
+        out.key(key);
+        out.number(value);
+    }
+    for (auto [key, value] : {std::pair{"seconds", m.seconds},
+                              std::pair{"gb_per_s", m.gb_per_s},
+                              std::pair{"ns_per_item", m.ns_per_item}}) {
+        out.comma();
+        out.key(key);
+        out.number(value);
+    }
+    out.end_object();
+    std::string_view text = out.str();
+    std::printf("%.*s\n", static_cast<int>(text.size()), text.data());
+}
+
+/** Run every requested operation over every path, with the interpreter initialized.
+
+    @return The process's exit status.
+ */
+int run_all(const options& opts) {
+    if (opts.implementation) {
+        const simdjson::implementation* impl =
+            simdjson::available_implementations[opts.implementation];
+        if (!impl || !impl->supported_by_runtime_system()) {
+            std::fprintf(stderr,
+                         "native_benchmark: error: simdjson implementation %s is "
+                         "unknown or not supported by this CPU\n",
+                         opts.implementation);
+            return 2;
+        }
+        simdjson::active_implementation = impl;
+    }
+
+    if (!opts.json) {
+        std::printf("%-40s %-18s %8s %10s %11s %11s\n",
+                    "file",
+                    "operation",
+                    "GB/s",
+                    "ns/item",
+                    "py allocs",
+                    "c++ allocs");
+    }
+    for (const std::string& path : opts.paths) {
+        for (const registry_entry* entry : opts.operations) {
+            std::optional<measurement> m;
+            try {
+                m = run(path, entry->second, opts.min_time);
+            }
+            catch (const py::exception& e) {
+                std::fflush(stdout);
+                std::fprintf(stderr, "native_benchmark: %s: ", path.c_str());
+                if (PyErr_Occurred()) {
+                    PyErr_Print();
+                }
+                else {
+                    std::fprintf(stderr, "%s\n", e.what());
+                }
+                return 1;
+            }
+            catch (const std::exception& e) {
+                std::fflush(stdout);
+                std::fprintf(stderr,
+                             "native_benchmark: %s: %s\n",
+                             path.c_str(),
+                             e.what());
+                return 1;
+            }
+            if (m) {
+                // otherwise there is nothing in this document for the operation
+                print(path, entry->first, *m, opts.json);
+                std::fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
+}  // namespace
+}  // namespace libpy_simdjson::native_benchmark
+
+int main(int argc, char** argv) {
+    using namespace libpy_simdjson::native_benchmark;
+
+    std::optional<options> opts = parse_args(argc, argv);
+    if (!opts) {
+        return 2;
+    }
+    if (opts->list_operations) {
+        for (const registry_entry& entry : registry) {
+            std::printf("%s\n", entry.first);
+        }
+        return 0;
+    }
+
+    Py_InitializeEx(0);
+    int status = run_all(*opts);
+    if (Py_FinalizeEx() < 0) {
+        status = 1;
+    }
+    return status;
+}
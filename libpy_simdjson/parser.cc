@@ -1,536 +1,410 @@
-#include <algorithm>
-#include <filesystem>
-#include <memory>
-#include <string>
-
-#include <libpy/autoclass.h>
-#include <libpy/autofunction.h>
-#include <libpy/automodule.h>
-#include <libpy/build_tuple.h>
-#include <libpy/itertools.h>
-#include <libpy/to_object.h>
-#include <range/v3/all.hpp>
-
-#include "simdjson.h"
+#include "parser.h"
 
 namespace libpy_simdjson {
-template<typename F>
-decltype(auto) as_static_type(simdjson::dom::element el, F&& f) {
-    switch (el.type()) {
-    case simdjson::dom::element_type::ARRAY:
-        return std::forward<F>(f)(simdjson::dom::array(el));
-    case simdjson::dom::element_type::OBJECT:
-        return std::forward<F>(f)(simdjson::dom::object(el));
-    case simdjson::dom::element_type::INT64:
-        return std::forward<F>(f)(int64_t(el));
-    case simdjson::dom::element_type::UINT64:
-        return std::forward<F>(f)(uint64_t(el));
-    case simdjson::dom::element_type::DOUBLE:
-        return std::forward<F>(f)(double(el));
-    case simdjson::dom::element_type::STRING:
-        return std::forward<F>(f)(std::string_view(el));
-    case simdjson::dom::element_type::BOOL:
-        return std::forward<F>(f)(bool(el));
-    case simdjson::dom::element_type::NULL_VALUE:
-        return std::forward<F>(f)(nullptr);
-    default:
-        throw py::exception(PyExc_ValueError, "Unexpected element_type encountered");
-    }
+std::shared_ptr<parser>
+make_parser(decode_strings_arg decode_strings,
+            parser::capacity_arg capacity,
+            parser::max_depth_arg max_depth,
+            py::arg::opt_keyword<decltype("max_capacity"_cs), std::size_t> max_capacity,
+            py::arg::opt_keyword<decltype("collect_stats"_cs), bool> collect_stats) {
+    auto out = std::make_shared<parser>(decode_strings.get().value_or(false),
+                                        collect_stats.get().value_or(false));
+    if (max_capacity.get()) {
+        out->set_max_capacity(*max_capacity.get());
+    }
+    if (capacity.get() || max_depth.get()) {
+        out->allocate(capacity.get().value_or(0),
+                      max_depth.get().value_or(simdjson::DEFAULT_MAX_DEPTH));
+    }
+    return out;
 }
 
-}  // namespace libpy_simdjson
+// The parsers kept by ``with_default_parser`` on every thread, so that
+// ``shrink_default_parsers`` can reach them. Only touched with the GIL held.
+std::vector<std::weak_ptr<parser>> default_parsers;
 
-namespace py::dispatch {
+/** Call ``f`` with this thread's parser for the module level functions.
 
-template<>
-struct to_object<simdjson::dom::array> : public sequence_to_object<simdjson::dom::array> {
-};
+    Allocating a ``dom::parser`` and its buffers costs more than parsing a small
+    document, so each thread keeps one parser per ``decode_strings`` setting. Results
+    detach their documents, so the parser can be reused while earlier results are
+    alive, and its spare document saves reallocating the tape once they are dropped.
 
-template<>
-struct to_object<simdjson::dom::object> : public map_to_object<simdjson::dom::object> {};
-
-template<>
-struct to_object<simdjson::dom::element> {
-    static py::owned_ref<> f(const simdjson::dom::element& element) {
-        return libpy_simdjson::as_static_type(element, [](auto el) {
-            if constexpr (std::is_same_v<decltype(el), std::nullptr_t>) {
-                return py::none;
-            }
-            else {
-                return py::to_object(el);
+    A parser that has grown past ``max_default_capacity`` is dropped after the call so
+    that one large document does not pin its buffers, several times its size, for the
+    life of the thread; ``shrink_default_parsers`` frees the rest. If the thread's
+    parser is already in use further up the stack, e.g. when a finalizer run while
+    building a result calls ``loads``, a fresh parser is used instead.
+ */
+template<typename F>
+py::owned_ref<> with_default_parser(bool decode_strings, F&& f) {
+    constexpr std::size_t max_default_capacity = 1 << 20;
+    thread_local std::shared_ptr<parser> cached[2];
+    thread_local bool in_use = false;
+
+    bool collect_stats = default_parsers_collect_stats.load(std::memory_order_relaxed);
+    if (in_use) {
+        return f(*std::make_shared<parser>(decode_strings, collect_stats));
+    }
+
+    std::shared_ptr<parser>& slot = cached[decode_strings];
+    if (!slot) {
+        slot = std::make_shared<parser>(decode_strings);
+        // forget the parsers of threads that have exited
+        default_parsers.erase(std::remove_if(default_parsers.begin(),
+                                             default_parsers.end(),
+                                             [](const auto& p) { return p.expired(); }),
+                              default_parsers.end());
+        default_parsers.emplace_back(slot);
+    }
+    // hold a reference of our own; the slot may be reset below
+    std::shared_ptr<parser> p = slot;
+    p->set_collect_stats(collect_stats);
+
+    struct release {
+        std::shared_ptr<parser>& slot;
+        const parser& p;
+
+        ~release() {
+            in_use = false;
+            if (p.capacity() > max_default_capacity) {
+                slot.reset();
             }
-        });
-    }
-};
-
-template<typename T>
-struct to_object<simdjson::simdjson_result<T>> {
-    static py::owned_ref<> f(const simdjson::simdjson_result<T>& maybe_result) {
-        simdjson::dom::element result;
-        auto error = maybe_result.get(result);
-        if (error) {
-            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
         }
-        return py::to_object(result);
-    }
-};
-
-template<>
-struct to_object<simdjson::dom::key_value_pair> {
-    static py::owned_ref<> f(const simdjson::dom::key_value_pair& key_value_pair) {
-        return py::build_tuple(key_value_pair.key, key_value_pair.value);
-    }
-};
-
-}  // namespace py::dispatch
-
-namespace libpy_simdjson {
-
-template<typename T>
-bool element_eq(T a, T b) {
-    return a == b;
+    };
+    in_use = true;
+    release guard{slot, *p};
+    return f(*p);
 }
 
-bool element_eq(simdjson::dom::object lhs, simdjson::dom::object rhs);
-
-bool element_eq(simdjson::dom::array lhs, simdjson::dom::array rhs) {
-    return lhs.size() == rhs.size() &&
-           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](auto a, auto b) {
-               return as_static_type(a, [&](auto a_static) {
-                   if constexpr (std::is_same_v<decltype(a_static), std::nullptr_t>) {
-                       return b.type() == simdjson::dom::element_type::NULL_VALUE;
-                   }
-                   else {
-                       decltype(a_static) b_static;
-                       if (b.get(b_static)) {
-                           return false;
-                       }
-                       return element_eq(a_static, b_static);
-                   }
-               });
-           });
+py::owned_ref<> load(const std::filesystem::path& filename,
+                     decode_strings_arg decode_strings) {
+    return with_default_parser(decode_strings.get().value_or(false), [&](parser& p) {
+        // the parser is kept for the thread, so it must not keep the file mapped
+        return p.load(filename, false);
+    });
 }
 
-bool element_eq(simdjson::dom::object lhs, simdjson::dom::object rhs) {
-    return lhs.size() == rhs.size() &&
-           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](auto a, auto b) {
-               return a.key == b.key && as_static_type(a.value, [&](auto a_static) {
-                          if constexpr (std::is_same_v<decltype(a_static),
-                                                       std::nullptr_t>) {
-                              return b.value.type() ==
-                                     simdjson::dom::element_type::NULL_VALUE;
-                          }
-                          else {
-                              decltype(a_static) b_static;
-                              if (b.value.get(b_static)) {
-                                  return false;
-                              }
-                              return element_eq(a_static, b_static);
-                          }
-                      });
-           });
+py::owned_ref<> loads(py::borrowed_ref<> in_buffer, decode_strings_arg decode_strings) {
+    input_buffer in{in_buffer};
+    return with_default_parser(decode_strings.get().value_or(false), [&](parser& p) {
+        return p.loads(in);
+    });
 }
 
-class parser : public std::enable_shared_from_this<parser> {
-private:
-    simdjson::dom::parser m_parser;
-
-public:
-    parser() = default;
-
-    std::shared_ptr<parser> getptr() {
-        return shared_from_this();
-    }
-
-    py::owned_ref<> load(const std::filesystem::path& filename);
-
-    py::owned_ref<> loads(std::string_view in_string);
-
-    static py::owned_ref<> load_method(const std::shared_ptr<parser>& p,
-                                       const std::filesystem::path& filename) {
-        return p->load(filename);
-    }
-
-    static py::owned_ref<> loads_method(const std::shared_ptr<parser>& p,
-                                        std::string_view in_string) {
-        return p->loads(in_string);
-    }
-};
-
-class object_element {
-private:
-    std::shared_ptr<parser> m_parser;
-    simdjson::dom::object m_value;
-
-public:
-    object_element(std::shared_ptr<parser> parser_pntr, simdjson::dom::object value)
-        : m_parser(parser_pntr), m_value(value) {}
-
-    py::owned_ref<> operator[](const std::string& field);
-
-    py::owned_ref<> at_pointer(const std::string& json_pntr);
-
-    py::owned_ref<> items() const {
-        return py::dispatch::sequence_to_object<simdjson::dom::object>::f(m_value);
-    }
-
-private:
-    auto keys_range() const {
-        return m_value |
-               ranges::views::transform([](const auto& item) { return item.key; });
-    }
-
-public:
-    py::owned_ref<> keys() const {
-        auto keys = keys_range();
-        return py::dispatch::sequence_to_object<decltype(keys)>::f(keys);
-    }
-
-    py::owned_ref<> values() const {
-        auto values = m_value | ranges::views::transform(
-                                    [](const auto& item) { return item.value; });
-        return py::dispatch::sequence_to_object<decltype(values)>::f(values);
-    }
-
-    py::owned_ref<> as_dict() const {
-        return py::to_object(m_value);
-    }
+py::owned_ref<> validate(py::borrowed_ref<> in_buffer,
+                         structural_only_arg structural_only) {
+    input_buffer in{in_buffer};
+    return with_default_parser(false, [&](parser& p) {
+        return p.validate(in, structural_only.get().value_or(false)).to_object();
+    });
+}
 
-    std::size_t size() const {
-        return m_value.size();
+py::owned_ref<> implementation_name(const simdjson::implementation& impl) {
+    const std::string& name = impl.name();
+    py::owned_ref<> out{PyUnicode_FromStringAndSize(name.data(), name.size())};
+    if (!out) {
+        throw py::exception{};
     }
+    return out;
+}
 
-    auto begin() const {
-        return keys_range().begin();
+py::owned_ref<> parser::implementation_method(const std::shared_ptr<parser>& p) {
+    if (!p->m_kernel) {
+        return py::owned_ref<>::new_reference(Py_None);
     }
+    return implementation_name(*p->m_kernel);
+}
 
-    auto end() const {
-        return keys_range().end();
+/** The names of the simdjson implementations this CPU can run, best first.
+ */
+py::owned_ref<> implementations() {
+    py::owned_ref<> out{PyList_New(0)};
+    if (!out) {
+        throw py::exception{};
     }
-
-    bool operator==(const object_element& other) {
-        if (this->size() != other.size()) {
-            return false;
+    for (const simdjson::implementation* impl : simdjson::available_implementations) {
+        if (!impl->supported_by_runtime_system()) {
+            continue;
+        }
+        if (PyList_Append(out.get(), implementation_name(*impl).get())) {
+            throw py::exception{};
         }
-
-        return element_eq(this->m_value, other.m_value);
-    }
-};
-
-class array_element {
-private:
-    std::shared_ptr<parser> m_parser;
-    simdjson::dom::array m_value;
-
-public:
-    array_element(std::shared_ptr<parser> parser_pntr, simdjson::dom::array value)
-        : m_parser(parser_pntr), m_value(value) {}
-
-    py::owned_ref<> at_pointer(const std::string& json_pntr);
-
-    py::owned_ref<> operator[](std::ptrdiff_t index);
-
-    py::owned_ref<> as_list() {
-        return py::to_object(m_value);
-    }
-
-    std::size_t size() const {
-        return m_value.size();
     }
+    return out;
+}
 
-    typedef simdjson::dom::array::iterator iterator;
-
-    iterator begin() const {
-        return m_value.begin();
-    }
+/** The name of the simdjson implementation new parses use. Unless it has been set,
+    this is the best one for this CPU, or the one named by the
+    ``SIMDJSON_FORCE_IMPLEMENTATION`` environment variable.
+ */
+py::owned_ref<> active_implementation() {
+    // asking the placeholder that detects the CPU for its name makes it pick one
+    return implementation_name(*simdjson::active_implementation);
+}
 
-    iterator end() const {
-        return m_value.end();
+/** Make later parses use the simdjson implementation called ``name``, returning the
+    name of the previous one. Every parser switches at its next parse.
+ */
+py::owned_ref<> set_implementation(py::borrowed_ref<> name_ob) {
+    Py_ssize_t size;
+    const char* data = PyUnicode_AsUTF8AndSize(name_ob.get(), &size);
+    if (!data) {
+        throw py::exception{};
+    }
+    std::string_view name(data, size);
+    const simdjson::implementation* impl = simdjson::available_implementations[name];
+    if (!impl) {
+        throw py::exception(PyExc_ValueError, "unknown simdjson implementation: ", name);
+    }
+    if (!impl->supported_by_runtime_system()) {
+        throw py::exception(PyExc_ValueError,
+                            "simdjson implementation ",
+                            name,
+                            " is not supported by this CPU");
     }
+    py::owned_ref<> previous = active_implementation();
+    simdjson::active_implementation = impl;
+    return previous;
+}
 
-    bool operator==(const array_element& other) {
-        if (this->size() != other.size()) {
-            return false;
-        }
-
-        return element_eq(this->m_value, other.m_value);
-    }
+/** The totals over every parser that collects statistics, including the parsers
+    behind the module level functions once ``collect_stats(True)`` has been called.
+ */
+py::owned_ref<> stats() {
+    return global_stats.to_dict();
+}
 
-private:
-    template<simdjson::dom::element_type type, typename T>
-    std::size_t specialized_count(py::borrowed_ref<> generic_needle,
-                                  T needle,
-                                  iterator it,
-                                  iterator end) const {
-        std::size_t out = 0;
-        for (; it != end; ++it) {
-            const auto& e = *it;
-            if (e.type() != type) {
-                return out + generic_count(generic_needle, it, end);
-            }
-            out += needle == T(e);
-        }
-        return out;
-    }
+void reset_stats() {
+    global_stats.reset();
+}
 
-    std::size_t
-    generic_count(py::borrowed_ref<> needle, iterator it, iterator end) const {
-        std::size_t out = 0;
-        py::object_map_key needle_cmp{needle};
-        for (; it != end; ++it) {
-            py::object_map_key rhs = py::to_object(*it);
-            if (!rhs) {
-                throw py::exception{};
-            }
-            out += needle_cmp == rhs;
+/** Free the buffers of every thread's parser for the module level functions, skipping
+    any that is parsing right now.
+
+    @return The number of parsers shrunk.
+ */
+std::size_t shrink_default_parsers() {
+    std::size_t out = 0;
+    for (const auto& weak : default_parsers) {
+        std::shared_ptr<parser> p = weak.lock();
+        if (!p) {
+            continue;
         }
-        return out;
-    }
-
-    template<simdjson::dom::element_type type, typename T>
-    std::size_t try_specialized_count(py::borrowed_ref<> needle) const {
-        T converted;
         try {
-            converted = py::from_object<T>(needle);
+            p->shrink(0);
+            ++out;
         }
-        catch (const py::invalid_conversion&) {
+        catch (const py::exception&) {
+            // the parser is in use on its thread
             PyErr_Clear();
-            return generic_count(needle, begin(), end());
         }
-        return specialized_count<type, T>(needle, converted, begin(), end());
     }
+    return out;
+}
 
-    std::size_t count_null() const {
-        std::size_t out = 0;
-        for (const auto& e : *this) {
-            out += e.type() == simdjson::dom::element_type::NULL_VALUE;
-        }
-        return out;
-    }
+/** Set whether the module level functions collect statistics, returning the previous
+    setting.
+ */
+bool collect_stats(bool enabled) {
+    return default_parsers_collect_stats.exchange(enabled);
+}
 
-    template<simdjson::dom::element_type type, typename T>
-    std::ptrdiff_t specialized_index(py::borrowed_ref<> generic_needle,
-                                  T needle,
-                                  iterator it,
-                                  iterator end) const {
-        std::ptrdiff_t out = -1;
-        std::ptrdiff_t index = 0;
-        for (; it != end; ++it) {
-            const auto& e = *it;
-            if (e.type() != type) {
-                return generic_index(generic_needle, it, end, index);
-            }
-            if (needle == T(e)) {
-                out = index;
-                break;
-            }
-            index++;
-        }
-        return out;
+parser_pool
+make_parser_pool(py::arg::opt_keyword<decltype("size"_cs), std::size_t> size,
+                 decode_strings_arg decode_strings) {
+    std::size_t n_parsers = size.get().value_or(
+        std::max<std::size_t>(std::thread::hardware_concurrency(), 1));
+    if (n_parsers == 0) {
+        throw py::exception(PyExc_ValueError, "a ParserPool needs at least one parser");
     }
+    return parser_pool{n_parsers, decode_strings.get().value_or(false)};
+}
 
-    std::ptrdiff_t
-    generic_index(py::borrowed_ref<> needle, iterator it, iterator end, std::ptrdiff_t index = 0) const {
-        std::size_t out = -1;
-        py::object_map_key needle_cmp{needle};
-        for (; it != end; ++it) {
-            py::object_map_key rhs = py::to_object(*it);
-            if (!rhs) {
-                throw py::exception{};
-            }
-            if (needle_cmp == rhs) {
-                out = index;
-                break;
-            }
-            index++;
-        }
-        return out;
-    }
+padded_buffer make_padded_buffer(py::borrowed_ref<> data) {
+    input_buffer in_buffer{data};
+    return padded_buffer{std::string_view(in_buffer.data(), in_buffer.size())};
+}
 
-    template<simdjson::dom::element_type type, typename T>
-    std::ptrdiff_t try_specialized_index(py::borrowed_ref<> needle) const {
-        T converted;
-        try {
-            converted = py::from_object<T>(needle);
+/** Remove the whitespace between the tokens of some JSON text with ``simdjson::minify``.
+
+    The text is not validated, only scanned for strings. The GIL is released while the
+    text is minified.
+
+    @param in_buffer The JSON text: anything ``loads`` accepts.
+    @param out A writable buffer at least as long as ``in_buffer`` to minify into.
+    @return The minified text as ``bytes``, or the number of bytes written to ``out``.
+ */
+py::owned_ref<> minify(py::borrowed_ref<> in_buffer,
+                       py::arg::opt_keyword<decltype("out"_cs), py::borrowed_ref<>> out) {
+    input_buffer in{in_buffer};
+
+    auto run = [&](char* dst) {
+        std::size_t written;
+        simdjson::error_code error;
+        {
+            py::gil::release_block released;
+            error = simdjson::minify(in.data(), in.size(), dst, written);
         }
-        catch (const py::invalid_conversion&) {
-            PyErr_Clear();
-            return generic_index(needle, begin(), end());
+        if (error) {
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
         }
-        return specialized_index<type, T>(needle, converted, begin(), end());
-    }
-
-    std::ptrdiff_t index_null() const {
-        std::ptrdiff_t out = -1;
-        for (auto [index, value] : py::enumerate(*this)) {
-            if (value.type() == simdjson::dom::element_type::NULL_VALUE) {
-                out = index;
-                break;
-            }
+        return written;
+    };
+
+    if (out.get()) {
+        py::buffer out_buffer = py::get_buffer(*out.get(), PyBUF_WRITABLE);
+        if (static_cast<std::size_t>(out_buffer->len) < in.size()) {
+            throw py::exception(PyExc_ValueError,
+                                "out must hold at least ",
+                                in.size(),
+                                " bytes, got ",
+                                out_buffer->len);
         }
-
-        return out;
+        return py::to_object(run(static_cast<char*>(out_buffer->buf)));
     }
 
-public:
-    std::ptrdiff_t index(py::borrowed_ref<> needle) const {
-        if (size() == 0) {
-            throw py::exception(PyExc_ValueError, "'", needle, "' is not in Array");
-        }
-
-        std::ptrdiff_t out;
+    // minified text is never longer than its input; allocate that and shrink in place
+    py::owned_ref<> result{PyBytes_FromStringAndSize(nullptr, in.size())};
+    if (!result) {
+        throw py::exception{};
+    }
+    std::size_t written = run(PyBytes_AS_STRING(result.get()));
+    PyObject* raw = std::move(result).escape();
+    if (_PyBytes_Resize(&raw, written)) {
+        throw py::exception{};
+    }
+    return py::owned_ref<>{raw};
+}
 
-        if (needle.get() == Py_None) {
-            out = index_null();
-        }
+/** The text of ``ob``, a ``str`` or ``bytes``, to write as a JSON string or key.
 
-        switch ((*begin()).type()) {
-        case simdjson::dom::element_type::INT64:
-            out = try_specialized_index<simdjson::dom::element_type::INT64, std::int64_t>(
-                needle);
-            break;
-        case simdjson::dom::element_type::UINT64:
-            out =
-                try_specialized_index<simdjson::dom::element_type::UINT64, std::uint64_t>(
-                    needle);
-            break;
-        case simdjson::dom::element_type::DOUBLE:
-            out = try_specialized_index<simdjson::dom::element_type::DOUBLE, double>(
-                needle);
-            break;
-        case simdjson::dom::element_type::STRING:
-            out = try_specialized_index<simdjson::dom::element_type::STRING,
-                                        std::string_view>(needle);
-            break;
-        case simdjson::dom::element_type::BOOL:
-            out = try_specialized_index<simdjson::dom::element_type::BOOL, bool>(needle);
-            break;
-        default:
-            out = generic_index(needle, begin(), end());
-        }
-        if (out < 0) {
-            throw py::exception(PyExc_ValueError, "'", needle, "' is not in Array");
-        }
-
-        return out;
+    ``bytes`` must be UTF-8 like the rest of the output, so they are validated.
+ */
+std::string_view json_string_text(py::borrowed_ref<> ob) {
+    std::string_view text = text_view(ob);
+    if (PyBytes_Check(ob.get()) && !simdjson::validate_utf8(text)) {
+        throw py::exception(PyExc_ValueError, "bytes value is not valid UTF-8");
     }
+    return text;
+}
 
-    std::size_t count(py::borrowed_ref<> needle) const {
-        if (size() == 0) {
-            return 0;
+/** Write a native Python object as JSON.
+
+    ``str`` and ``bytes`` are both written as strings, matching how strings are read;
+    ``bytes`` that are not UTF-8 raise ``ValueError``. ``Object`` and ``Array`` values
+    are copied straight from their tapes.
+ */
+void write_python(json_writer& out, py::borrowed_ref<> ob) {
+    if (ob.get() == Py_None) {
+        out.null_atom();
+    }
+    else if (ob.get() == Py_True) {
+        out.true_atom();
+    }
+    else if (ob.get() == Py_False) {
+        out.false_atom();
+    }
+    else if (PyLong_Check(ob.get())) {
+        int overflow;
+        long long value = PyLong_AsLongLongAndOverflow(ob.get(), &overflow);
+        if (overflow) {
+            // JSON numbers are unbounded, and so is the decimal text of an int
+            py::owned_ref<> text{PyLong_Type.tp_repr(ob.get())};
+            if (!text) {
+                throw py::exception{};
+            }
+            out.raw(text_view(text));
         }
-
-        if (needle.get() == Py_None) {
-            return count_null();
+        else if (value == -1 && PyErr_Occurred()) {
+            throw py::exception{};
         }
-
-        switch ((*begin()).type()) {
-        case simdjson::dom::element_type::INT64:
-            return try_specialized_count<simdjson::dom::element_type::INT64,
-                                         std::int64_t>(needle);
-        case simdjson::dom::element_type::UINT64:
-            return try_specialized_count<simdjson::dom::element_type::UINT64,
-                                         std::uint64_t>(needle);
-        case simdjson::dom::element_type::DOUBLE:
-            return try_specialized_count<simdjson::dom::element_type::DOUBLE, double>(
-                needle);
-        case simdjson::dom::element_type::STRING:
-            return try_specialized_count<simdjson::dom::element_type::STRING,
-                                         std::string_view>(needle);
-        case simdjson::dom::element_type::BOOL:
-            return try_specialized_count<simdjson::dom::element_type::BOOL, bool>(needle);
-        default:
-            return generic_count(needle, begin(), end());
+        else {
+            out.number(static_cast<std::int64_t>(value));
         }
     }
-};
-
-py::owned_ref<> disambiguate_result(std::shared_ptr<parser> parser_pntr,
-                                    simdjson::dom::element result) {
-    auto result_type = result.type();
-    switch (result_type) {
-    case simdjson::dom::element_type::ARRAY:
-        return py::autoclass<array_element>::construct(parser_pntr, result);
-    case simdjson::dom::element_type::OBJECT:
-        return py::autoclass<object_element>::construct(parser_pntr, result);
-    default:
-        return py::to_object(result);
-    }
-}
-
-py::owned_ref<> parser::load(const std::filesystem::path& filename) {
-    if (weak_from_this().use_count() > 1) {
-        throw py::exception(PyExc_ValueError,
-                            "cannot reparse while live objects exist from a prior parse");
+    else if (PyFloat_Check(ob.get())) {
+        double value = PyFloat_AS_DOUBLE(ob.get());
+        if (!std::isfinite(value)) {
+            throw py::exception(PyExc_ValueError,
+                                "out of range float values are not JSON compliant: ",
+                                value);
+        }
+        out.number(value);
     }
-    auto maybe_result = m_parser.load(filename.string());
-    simdjson::dom::element result;
-    auto error = maybe_result.get(result);
-    if (error) {
-        throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+    else if (PyUnicode_Check(ob.get()) || PyBytes_Check(ob.get())) {
+        out.string(json_string_text(ob));
     }
-    return disambiguate_result(shared_from_this(), result);
-}
-
-py::owned_ref<> parser::loads(std::string_view in_string) {
-    if (weak_from_this().use_count() > 1) {
-        throw py::exception(PyExc_ValueError,
-                            "cannot reparse while live objects exist from a prior parse");
+    else if (object_type && PyObject_TypeCheck(ob.get(), object_type)) {
+        py::autoclass<object_element>::unbox(ob).dump(out);
     }
-    auto maybe_result = m_parser.parse(in_string.data(), in_string.size());
-    simdjson::dom::element result;
-    auto error = maybe_result.get(result);
-    if (error) {
-        throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+    else if (array_type && PyObject_TypeCheck(ob.get(), array_type)) {
+        py::autoclass<array_element>::unbox(ob).dump(out);
     }
-    return disambiguate_result(shared_from_this(), result);
-}
-
-py::owned_ref<> object_element::operator[](const std::string& field) {
-    return disambiguate_result(m_parser, m_value[field]);
-}
-
-py::owned_ref<> object_element::at_pointer(const std::string& json_pntr) {
-    simdjson::dom::element result;
-    auto maybe_result = m_value.at_pointer(json_pntr);
-    auto error = maybe_result.get(result);
-    if (error) {
-        throw py::exception(PyExc_KeyError, json_pntr);
+    else if (PyDict_Check(ob.get()) || PyList_Check(ob.get()) ||
+             PyTuple_Check(ob.get())) {
+        // containers may be self referential; fail like ``json.dumps`` instead of
+        // overflowing the stack
+        if (Py_EnterRecursiveCall(" while encoding a JSON value")) {
+            throw py::exception{};
+        }
+        struct leave_recursive_call {
+            ~leave_recursive_call() {
+                Py_LeaveRecursiveCall();
+            }
+        } leave;
+
+        if (PyDict_Check(ob.get())) {
+            out.start_object();
+            Py_ssize_t pos = 0;
+            PyObject* key;
+            PyObject* value;
+            bool first = true;
+            while (PyDict_Next(ob.get(), &pos, &key, &value)) {
+                if (!(PyUnicode_Check(key) || PyBytes_Check(key))) {
+                    throw py::exception(PyExc_TypeError,
+                                        "keys must be str or bytes, not ",
+                                        Py_TYPE(key)->tp_name);
+                }
+                if (!first) {
+                    out.comma();
+                }
+                first = false;
+                out.key(json_string_text(key));
+                write_python(out, value);
+            }
+            out.end_object();
+        }
+        else {
+            out.start_array();
+            Py_ssize_t size = PySequence_Fast_GET_SIZE(ob.get());
+            PyObject** items = PySequence_Fast_ITEMS(ob.get());
+            for (Py_ssize_t ix = 0; ix < size; ++ix) {
+                if (ix) {
+                    out.comma();
+                }
+                write_python(out, items[ix]);
+            }
+            out.end_array();
+        }
     }
-    return disambiguate_result(m_parser, result);
-}
-
-py::owned_ref<> array_element::at_pointer(const std::string& json_pntr) {
-    simdjson::dom::element result;
-    auto maybe_result = m_value.at_pointer(json_pntr);
-    auto error = maybe_result.get(result);
-    if (error) {
-        throw py::exception(PyExc_IndexError, json_pntr);
+    else {
+        throw py::exception(PyExc_TypeError,
+                            "Object of type ",
+                            Py_TYPE(ob.get())->tp_name,
+                            " is not JSON serializable");
     }
-    return disambiguate_result(m_parser, result);
 }
 
-py::owned_ref<> array_element::operator[](std::ptrdiff_t index) {
-    std::ptrdiff_t original_index = index;
-    if (index < 0) {
-        index += m_value.size();
+py::owned_ref<> dumps(py::borrowed_ref<> ob) {
+    json_writer out;
+    write_python(out, ob);
+    std::string_view text = out.str();
+    py::owned_ref<> result{PyBytes_FromStringAndSize(text.data(), text.size())};
+    if (!result) {
+        throw py::exception{};
     }
-
-    simdjson::dom::element result;
-    auto maybe_result = m_value.at(index);
-    auto error = maybe_result.get(result);
-    if (error) {
-        throw py::exception(PyExc_IndexError, original_index);
-    }
-    return disambiguate_result(m_parser, result);
-}
-
-py::owned_ref<> load(const std::filesystem::path& filename) {
-    return std::make_shared<parser>()->load(filename);
-}
-
-py::owned_ref<> loads(const std::string& in_string) {
-    return std::make_shared<parser>()->loads(in_string);
+    return result;
 }
 
 py::owned_ref<> __simdjson_version__() {
@@ -541,35 +415,96 @@ LIBPY_AUTOMODULE(libpy_simdjson,
                  parser,
                  ({py::autofunction<load>("load"),
                    py::autofunction<loads>("loads"),
+                   py::autofunction<dumps>("dumps"),
+                   py::autofunction<minify>("minify"),
+                   py::autofunction<validate>("validate"),
+                   py::autofunction<stats>("stats"),
+                   py::autofunction<reset_stats>("reset_stats"),
+                   py::autofunction<collect_stats>("collect_stats"),
+                   py::autofunction<shrink_default_parsers>("shrink_default_parsers"),
+                   py::autofunction<implementations>("implementations"),
+                   py::autofunction<active_implementation>("active_implementation"),
+                   py::autofunction<set_implementation>("set_implementation"),
                    py::autofunction<__simdjson_version__>("__simdjson_version__")}))
 (py::borrowed_ref<> m) {
     py::autoclass<std::shared_ptr<parser>>(m, "Parser")
-        .new_<std::make_shared<parser>>()
+        .new_<make_parser>()
         .doc("Base parser")  // add a class docstring
         .def<&parser::load_method>("load")
         .def<&parser::loads_method>("loads")
+        .def<&parser::validate_method>("validate")
+        .def<&parser::allocate_method>("allocate")
+        .def<&parser::shrink_method>("shrink")
+        .def<&parser::capacity_method>("capacity")
+        .def<&parser::max_capacity_method>("max_capacity")
+        .def<&parser::max_depth_method>("max_depth")
+        .def<&parser::memory_usage_method>("memory_usage")
+        .def<&parser::stats_method>("stats")
+        .def<&parser::reset_stats_method>("reset_stats")
+        .def<&parser::implementation_method>("implementation")
+        .def<&parser::load_many_method>("load_many")
+        .def<&parser::parse_many_method>("parse_many")
         .type();
-    py::autoclass<object_element>(m, "Object")
-        .mapping<std::string>()
-        .def<&object_element::at_pointer>("at_pointer")
-        .def<&object_element::as_dict>("as_dict")
-        .def<&object_element::keys>("keys")
-        .def<&object_element::values>("values")
-        .def<&object_element::items>("items")
-        .comparisons<object_element>()
+    py::autoclass<parser_pool>(m, "ParserPool")
+        .new_<make_parser_pool>()
+        .doc("A parser per core, for parsing batches of documents concurrently")
+        .def<&parser_pool::load_all>("load_all")
+        .def<&parser_pool::loads_all>("loads_all")
         .len()
-        .iter()
         .type();
-    py::autoclass<array_element>(m, "Array")
-        .def<&array_element::at_pointer>("at_pointer")
-        .def<&array_element::as_list>("as_list")
-        .def<&array_element::count>("count")
-        .def<&array_element::index>("index")
-        .mapping<std::ptrdiff_t>()
-        .comparisons<array_element>()
-        .len()
+    py::autoclass<document_stream>(m, "DocumentStream")
+        .doc("Iterator over the documents of newline delimited or concatenated JSON")
         .iter()
         .type();
+    padded_buffer_type = py::autoclass<padded_buffer>(m, "PaddedBuffer")
+                             .new_<make_padded_buffer>()
+                             .doc("JSON text stored with the padding simdjson needs, "
+                                  "so that parsing it does not copy it again")
+                             .len()
+                             .type()
+                             .get();
+    pointer_type = py::autoclass<json_pointer>(m, "Pointer")
+                       .new_<make_pointer>()
+                       .doc("A JSON Pointer split into its tokens once, so that it can "
+                            "be resolved against many documents with at_pointer")
+                       .len()
+                       .type()
+                       .get();
+    object_type = py::autoclass<object_element>(m, "Object")
+                      .mapping<py::borrowed_ref<>>()
+                      .def<&object_element::at_pointer>("at_pointer")
+                      .def<&object_element::extract>("extract")
+                      .def<&object_element::as_dict>("as_dict")
+                      .def<&object_element::materialize>("materialize")
+                      .def<&object_element::dumps>("dumps")
+                      .def<&object_element::keys>("keys")
+                      .def<&object_element::values>("values")
+                      .def<&object_element::items>("items")
+                      .def<&object_element::digest>("digest")
+                      .comparisons<object_element>()
+                      .hash()
+                      .len()
+                      .iter()
+                      .type()
+                      .get();
+    array_type = py::autoclass<array_element>(m, "Array")
+                     .def<&array_element::at_pointer>("at_pointer")
+                     .def<&array_element::extract>("extract")
+                     .def<&array_element::as_list>("as_list")
+                     .def<&array_element::materialize>("materialize")
+                     .def<&array_element::dumps>("dumps")
+                     .def<&array_element::to_numpy>("to_numpy")
+                     .def<&array_element::to_columns>("to_columns")
+                     .def<&array_element::count>("count")
+                     .def<&array_element::index>("index")
+                     .mapping<std::ptrdiff_t>()
+                     .def<&array_element::digest>("digest")
+                     .comparisons<array_element>()
+                     .hash()
+                     .len()
+                     .iter()
+                     .type()
+                     .get();
 
     return false;
 }
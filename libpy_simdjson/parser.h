@@ -0,0 +1,3811 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libpy/autoclass.h>
+#include <libpy/autofunction.h>
+#include <libpy/automodule.h>
+#include <libpy/buffer.h>
+#include <libpy/build_tuple.h>
+#include <libpy/char_sequence.h>
+#include <libpy/from_object.h>
+#include <libpy/gil.h>
+#include <libpy/itertools.h>
+#include <libpy/to_object.h>
+#include <range/v3/all.hpp>
+
+#include "simdjson.h"
+
+// Kernels that scan the tape or string data are called through ``run_kernel``. On
+// x86-64 they are also built for AVX2, which runs while simdjson's active
+// implementation is its AVX2 one, ``haswell``. Elsewhere there is only the baseline
+// build, vectorized for whatever the target offers, e.g. NEON on aarch64.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LIBPY_SIMDJSON_AVX2_KERNELS 1
+#define LIBPY_SIMDJSON_TAPE_KERNEL inline __attribute__((always_inline))
+#else
+#define LIBPY_SIMDJSON_AVX2_KERNELS 0
+#define LIBPY_SIMDJSON_TAPE_KERNEL inline
+#endif
+
+// Parse statistics cost a few clock reads per document when a parser collects them;
+// building with -DLIBPY_SIMDJSON_STATS=0 removes them entirely.
+#ifndef LIBPY_SIMDJSON_STATS
+#define LIBPY_SIMDJSON_STATS 1
+#endif
+
+namespace libpy_simdjson {
+/** Tag for ``tape_access``.
+ */
+struct tape_access_tag;
+}  // namespace libpy_simdjson
+
+// ``tape_access`` relies on simdjson internals: that ``dom`` values hold a private
+// ``tape_ref`` and befriend ``string_builder``. It, and the code reading the tape
+// layout it exposes, must be re-checked when upgrading simdjson.
+static_assert(simdjson::SIMDJSON_VERSION_MAJOR == 0 &&
+                  simdjson::SIMDJSON_VERSION_MINOR == 6,
+              "tape_access has only been checked against simdjson 0.6");
+
+/** simdjson befriends every ``string_builder`` specialization; this one finds where a
+    ``dom`` value sits on its document's tape so that hot loops can read the tape
+    directly. It is the only code that reaches past simdjson's public API.
+ */
+template<>
+class simdjson::internal::string_builder<libpy_simdjson::tape_access_tag> {
+public:
+    /** The document that ``value``, an element, array or object, belongs to.
+     */
+    template<typename T>
+    static const simdjson::dom::document& document(const T& value) {
+        return *value.tape.doc;
+    }
+
+    /** The index of ``value``'s first word in ``document(value).tape``.
+     */
+    template<typename T>
+    static std::size_t index(const T& value) {
+        return value.tape.json_index;
+    }
+};
+
+namespace libpy_simdjson {
+using tape_access = simdjson::internal::string_builder<tape_access_tag>;
+
+#if LIBPY_SIMDJSON_AVX2_KERNELS
+/** Whether the active simdjson implementation is ``haswell``, so the CPU has AVX2.
+ */
+inline bool avx2_kernels_active() {
+    static const simdjson::implementation* haswell =
+        simdjson::available_implementations["haswell"];
+    return haswell && simdjson::active_implementation == haswell;
+}
+
+/** ``kernel``, a ``LIBPY_SIMDJSON_TAPE_KERNEL``, inlined into a function built for
+    AVX2.
+ */
+template<auto kernel, typename... Args>
+__attribute__((target("avx2"))) auto run_avx2_kernel(Args&&... args) {
+    return kernel(std::forward<Args>(args)...);
+}
+#endif
+
+/** Call ``kernel``, a ``LIBPY_SIMDJSON_TAPE_KERNEL``, built for the ISA of simdjson's
+    active implementation, so that ``set_implementation`` picks these kernels too.
+ */
+template<auto kernel, typename... Args>
+auto run_kernel(Args&&... args) {
+#if LIBPY_SIMDJSON_AVX2_KERNELS
+    if (avx2_kernels_active()) {
+        return run_avx2_kernel<kernel>(std::forward<Args>(args)...);
+    }
+#endif
+    return kernel(std::forward<Args>(args)...);
+}
+
+/** Count the ``(type word, value)`` pairs in ``words`` equal to ``(type, value)``.
+
+    @param typed Set to the number of pairs whose type word is ``type``.
+ */
+LIBPY_SIMDJSON_TAPE_KERNEL
+std::size_t count_tape_pairs(const std::uint64_t* words,
+                             std::size_t n_pairs,
+                             std::uint64_t type,
+                             std::uint64_t value,
+                             std::size_t& typed) {
+    std::size_t matches = 0;
+    std::size_t types = 0;
+    for (std::size_t ix = 0; ix < n_pairs; ++ix) {
+        bool type_match = words[2 * ix] == type;
+        types += type_match;
+        matches += type_match & (words[2 * ix + 1] == value);
+    }
+    typed = types;
+    return matches;
+}
+
+/** Find the first ``(type word, value)`` pair in ``words`` that is ``(type, value)`` or
+    whose type word is not ``type``.
+
+    @return The index of that pair, or ``n_pairs``.
+ */
+LIBPY_SIMDJSON_TAPE_KERNEL
+std::size_t find_tape_pair(const std::uint64_t* words,
+                           std::size_t n_pairs,
+                           std::uint64_t type,
+                           std::uint64_t value) {
+    constexpr std::size_t block = 8;
+    std::size_t ix = 0;
+    // test whole blocks without branching, then find the pair within the block
+    for (; ix + block <= n_pairs; ix += block) {
+        bool hit = false;
+        for (std::size_t jx = ix; jx < ix + block; ++jx) {
+            hit |= (words[2 * jx] != type) | (words[2 * jx + 1] == value);
+        }
+        if (hit) {
+            break;
+        }
+    }
+    for (; ix < n_pairs; ++ix) {
+        if (words[2 * ix] != type || words[2 * ix + 1] == value) {
+            return ix;
+        }
+    }
+    return n_pairs;
+}
+
+/** The length of the longest prefix of ``data`` that can be copied into a JSON string
+    as is, that is, which holds no control characters, quotes or backslashes.
+ */
+LIBPY_SIMDJSON_TAPE_KERNEL
+std::size_t unescaped_prefix(const char* data, std::size_t size) {
+    constexpr std::size_t block = 32;
+    auto needs_escape = [](unsigned char c) {
+        return (c < 0x20) | (c == '"') | (c == '\\');
+    };
+    std::size_t ix = 0;
+    // test whole blocks without branching, then find the byte within the block
+    for (; ix + block <= size; ix += block) {
+        bool hit = false;
+        for (std::size_t jx = ix; jx < ix + block; ++jx) {
+            hit |= needs_escape(data[jx]);
+        }
+        if (hit) {
+            break;
+        }
+    }
+    for (; ix < size; ++ix) {
+        if (needs_escape(data[ix])) {
+            return ix;
+        }
+    }
+    return size;
+}
+
+/** The finalizer of MurmurHash3, which mixes every bit of ``x`` into every bit of the
+    result.
+ */
+inline std::uint64_t hash_mix(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/** Added to an element's hash before mixing it in, once per position in its array, so
+    that reordering an array changes its hash.
+ */
+constexpr std::uint64_t hash_position_salt = 0x9e3779b97f4a7c15ULL;
+
+/** Rewrite a ``(type word, value)`` pair of the tape's two word numbers into its
+    canonical form: a double with an integral value becomes the pair simdjson writes
+    for that integer, an ``INT64``, or a ``UINT64`` above ``INT64_MAX``.
+
+    Two numbers are equal, as Python compares ``int`` and ``float``, exactly when their
+    canonical pairs are; ``-0.0`` and ``0.0`` both become the integer 0.
+ */
+inline void canonical_tape_number(std::uint64_t& type_word, std::uint64_t& value) {
+    using simdjson::internal::tape_type;
+    constexpr std::uint64_t double_word = std::uint64_t(tape_type::DOUBLE) << 56;
+    if (type_word != double_word) {
+        return;
+    }
+    double number;
+    std::memcpy(&number, &value, sizeof(number));
+    if (number != std::trunc(number)) {
+        return;
+    }
+    if (number >= -0x1p63 && number < 0x1p63) {
+        type_word = std::uint64_t(tape_type::INT64) << 56;
+        value = static_cast<std::uint64_t>(static_cast<std::int64_t>(number));
+    }
+    else if (number >= 0x1p63 && number < 0x1p64) {
+        type_word = std::uint64_t(tape_type::UINT64) << 56;
+        value = static_cast<std::uint64_t>(number);
+    }
+}
+
+/** Hash a ``(type word, value)`` pair of the tape's two word numbers, so that numbers
+    which compare equal hash equally.
+ */
+inline std::uint64_t hash_tape_number(std::uint64_t type_word, std::uint64_t value) {
+    canonical_tape_number(type_word, value);
+    return hash_mix(type_word ^ hash_mix(value));
+}
+
+/** Hash the ``(type word, value)`` pairs in ``words``, which are the elements of an
+    array starting at ``position``, as ``tape_hasher`` hashes array elements.
+
+    Each pair is hashed on its own and the results summed, so there is no dependency
+    between iterations.
+ */
+LIBPY_SIMDJSON_TAPE_KERNEL
+std::uint64_t hash_tape_pairs(const std::uint64_t* words,
+                              std::size_t n_pairs,
+                              std::uint64_t position) {
+    std::uint64_t out = 0;
+    for (std::size_t ix = 0; ix < n_pairs; ++ix) {
+        std::uint64_t salt = (position + ix) * hash_position_salt;
+        out += hash_mix(hash_tape_number(words[2 * ix], words[2 * ix + 1]) + salt);
+    }
+    return out;
+}
+
+/** Hash a string's bytes.
+
+    The bytes are read a word at a time into independent lanes, as in xxHash, which
+    compilers turn into a vector loop.
+ */
+LIBPY_SIMDJSON_TAPE_KERNEL
+std::uint64_t hash_bytes(const char* data, std::size_t size) {
+    constexpr std::size_t lanes = 4;
+    constexpr std::uint64_t prime_1 = 0x9e3779b185ebca87ULL;
+    constexpr std::uint64_t prime_2 = 0xc2b2ae3d27d4eb4fULL;
+    std::uint64_t acc[lanes] = {prime_1, prime_2, 0, std::uint64_t(0) - prime_1};
+    std::size_t ix = 0;
+    for (; ix + lanes * 8 <= size; ix += lanes * 8) {
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            std::uint64_t word;
+            std::memcpy(&word, data + ix + lane * 8, sizeof(word));
+            acc[lane] += word * prime_2;
+            acc[lane] = ((acc[lane] << 31) | (acc[lane] >> 33)) * prime_1;
+        }
+    }
+    std::uint64_t out = size;
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        out = hash_mix(out ^ acc[lane]);
+    }
+    for (; ix < size; ix += 8) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, data + ix, std::min<std::size_t>(8, size - ix));
+        out = hash_mix(out ^ (word * prime_2));
+    }
+    return out;
+}
+
+/** Writes minified JSON text.
+
+    This is a formatter for ``simdjson::internal::string_builder``, which walks the tape
+    of a ``dom`` value, and is also driven directly to write native Python objects.
+    Strings are scanned for bytes that need escaping with ``unescaped_prefix`` and
+    copied in runs between them.
+ */
+class json_writer {
+private:
+    std::string m_out;
+
+    void one_char(char c) {
+        m_out.push_back(c);
+    }
+
+public:
+    void comma() {
+        one_char(',');
+    }
+
+    void start_array() {
+        one_char('[');
+    }
+
+    void end_array() {
+        one_char(']');
+    }
+
+    void start_object() {
+        one_char('{');
+    }
+
+    void end_object() {
+        one_char('}');
+    }
+
+    void true_atom() {
+        m_out.append("true");
+    }
+
+    void false_atom() {
+        m_out.append("false");
+    }
+
+    void null_atom() {
+        m_out.append("null");
+    }
+
+    template<typename T>
+    void number(T value) {
+        char buffer[24];
+        auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        static_cast<void>(error);  // 24 characters fit any 64 bit integer
+        m_out.append(buffer, end);
+    }
+
+    void number(double value) {
+        char buffer[32];
+        char* end = simdjson::internal::to_chars(buffer, nullptr, value);
+        m_out.append(buffer, end);
+    }
+
+    void key(std::string_view unescaped) {
+        string(unescaped);
+        one_char(':');
+    }
+
+    void string(std::string_view unescaped) {
+        one_char('"');
+        while (!unescaped.empty()) {
+            std::size_t run = run_kernel<unescaped_prefix>(unescaped.data(),
+                                                          unescaped.size());
+            m_out.append(unescaped.data(), run);
+            if (run == unescaped.size()) {
+                break;
+            }
+            escape(unescaped[run]);
+            unescaped.remove_prefix(run + 1);
+        }
+        one_char('"');
+    }
+
+    /** Append text which is already valid JSON.
+     */
+    void raw(std::string_view text) {
+        m_out.append(text);
+    }
+
+    void clear() {
+        m_out.clear();
+    }
+
+    std::string_view str() const {
+        return m_out;
+    }
+
+private:
+    void escape(char c) {
+        switch (c) {
+        case '"':
+            m_out.append("\\\"");
+            break;
+        case '\\':
+            m_out.append("\\\\");
+            break;
+        case '\b':
+            m_out.append("\\b");
+            break;
+        case '\f':
+            m_out.append("\\f");
+            break;
+        case '\n':
+            m_out.append("\\n");
+            break;
+        case '\r':
+            m_out.append("\\r");
+            break;
+        case '\t':
+            m_out.append("\\t");
+            break;
+        default: {
+            constexpr char digits[] = "0123456789abcdef";
+            char escaped[] = {'\\', 'u', '0', '0', digits[c >> 4], digits[c & 0xf]};
+            m_out.append(escaped, sizeof(escaped));
+        }
+        }
+    }
+};
+
+/** Write ``value`` as minified JSON straight from the tape.
+ */
+template<typename T>
+void write_tape(json_writer& out, T value) {
+    simdjson::internal::string_builder<json_writer> builder;
+    builder.append(value);
+    out.raw(builder.str());
+}
+
+/** Serialize ``value`` to minified JSON ``bytes``.
+
+    The tape is immutable and outlives the call, so the GIL is released while writing.
+ */
+template<typename T>
+py::owned_ref<> dump_tape(T value) {
+    simdjson::internal::string_builder<json_writer> builder;
+    {
+        py::gil::release_block released;
+        builder.append(value);
+    }
+    std::string_view text = builder.str();
+    py::owned_ref<> out{PyBytes_FromStringAndSize(text.data(), text.size())};
+    if (!out) {
+        throw py::exception{};
+    }
+    return out;
+}
+
+template<typename F>
+decltype(auto) as_static_type(simdjson::dom::element el, F&& f) {
+    switch (el.type()) {
+    case simdjson::dom::element_type::ARRAY:
+        return std::forward<F>(f)(simdjson::dom::array(el));
+    case simdjson::dom::element_type::OBJECT:
+        return std::forward<F>(f)(simdjson::dom::object(el));
+    case simdjson::dom::element_type::INT64:
+        return std::forward<F>(f)(int64_t(el));
+    case simdjson::dom::element_type::UINT64:
+        return std::forward<F>(f)(uint64_t(el));
+    case simdjson::dom::element_type::DOUBLE:
+        return std::forward<F>(f)(double(el));
+    case simdjson::dom::element_type::STRING:
+        return std::forward<F>(f)(std::string_view(el));
+    case simdjson::dom::element_type::BOOL:
+        return std::forward<F>(f)(bool(el));
+    case simdjson::dom::element_type::NULL_VALUE:
+        return std::forward<F>(f)(nullptr);
+    default:
+        throw py::exception(PyExc_ValueError, "Unexpected element_type encountered");
+    }
+}
+
+}  // namespace libpy_simdjson
+
+namespace py::dispatch {
+
+template<>
+struct to_object<simdjson::dom::array> : public sequence_to_object<simdjson::dom::array> {
+};
+
+template<>
+struct to_object<simdjson::dom::object> : public map_to_object<simdjson::dom::object> {};
+
+template<>
+struct to_object<simdjson::dom::element> {
+    static py::owned_ref<> f(const simdjson::dom::element& element) {
+        return libpy_simdjson::as_static_type(element, [](auto el) {
+            if constexpr (std::is_same_v<decltype(el), std::nullptr_t>) {
+                return py::none;
+            }
+            else {
+                return py::to_object(el);
+            }
+        });
+    }
+};
+
+template<typename T>
+struct to_object<simdjson::simdjson_result<T>> {
+    static py::owned_ref<> f(const simdjson::simdjson_result<T>& maybe_result) {
+        simdjson::dom::element result;
+        auto error = maybe_result.get(result);
+        if (error) {
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+        }
+        return py::to_object(result);
+    }
+};
+
+template<>
+struct to_object<simdjson::dom::key_value_pair> {
+    static py::owned_ref<> f(const simdjson::dom::key_value_pair& key_value_pair) {
+        return py::build_tuple(key_value_pair.key, key_value_pair.value);
+    }
+};
+
+}  // namespace py::dispatch
+
+namespace libpy_simdjson {
+
+template<typename T>
+bool element_eq(T a, T b) {
+    return a == b;
+}
+
+inline bool element_eq(simdjson::dom::object lhs, simdjson::dom::object rhs);
+
+inline bool is_number_element(simdjson::dom::element value) {
+    auto type = value.type();
+    return type == simdjson::dom::element_type::INT64 ||
+           type == simdjson::dom::element_type::UINT64 ||
+           type == simdjson::dom::element_type::DOUBLE;
+}
+
+/** Compare two numbers by value, so that ``1 == 1.0`` whichever side is the double,
+    and integers beyond 2 ** 53 are not rounded through a double.
+ */
+inline bool number_eq(simdjson::dom::element a, simdjson::dom::element b) {
+    auto canonical = [](simdjson::dom::element value) {
+        const std::uint64_t* words = tape_access::document(value).tape.get() +
+                                     tape_access::index(value);
+        std::uint64_t type_word = words[0];
+        std::uint64_t bits = words[1];
+        canonical_tape_number(type_word, bits);
+        return std::make_pair(type_word, bits);
+    };
+    return canonical(a) == canonical(b);
+}
+
+inline bool element_eq(simdjson::dom::array lhs, simdjson::dom::array rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](auto a, auto b) {
+               if (is_number_element(a) && is_number_element(b)) {
+                   return number_eq(a, b);
+               }
+               return as_static_type(a, [&](auto a_static) {
+                   if constexpr (std::is_same_v<decltype(a_static), std::nullptr_t>) {
+                       return b.type() == simdjson::dom::element_type::NULL_VALUE;
+                   }
+                   else {
+                       decltype(a_static) b_static;
+                       if (b.get(b_static)) {
+                           return false;
+                       }
+                       return element_eq(a_static, b_static);
+                   }
+               });
+           });
+}
+
+inline bool element_eq(simdjson::dom::object lhs, simdjson::dom::object rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](auto a, auto b) {
+               if (a.key != b.key) {
+                   return false;
+               }
+               if (is_number_element(a.value) && is_number_element(b.value)) {
+                   return number_eq(a.value, b.value);
+               }
+               return as_static_type(a.value, [&](auto a_static) {
+                   if constexpr (std::is_same_v<decltype(a_static), std::nullptr_t>) {
+                       return b.value.type() == simdjson::dom::element_type::NULL_VALUE;
+                   }
+                   else {
+                       decltype(a_static) b_static;
+                       if (b.value.get(b_static)) {
+                           return false;
+                       }
+                       return element_eq(a_static, b_static);
+                   }
+               });
+           });
+}
+
+/** Hashes values straight from the tape, in agreement with ``element_eq``.
+
+    Numbers are hashed in their canonical form, so ``1`` and ``1.0`` hash equally.
+    Arrays add up their elements' hashes salted by position, so runs of numbers are
+    hashed by ``hash_tape_pairs``. Objects add up the hashes of their members, so an
+    object's hash does not depend on the order of its keys; objects that are equal have
+    the same keys in the same order, so they still hash equally.
+ */
+class tape_hasher {
+private:
+    using tape_type = simdjson::internal::tape_type;
+
+    const std::uint64_t* m_tape;
+    const std::uint8_t* m_strings;
+
+    static constexpr std::uint64_t array_tag = 0x5b;
+    static constexpr std::uint64_t object_tag = 0x7b;
+
+    static tape_type type_at(std::uint64_t word) {
+        return static_cast<tape_type>(word >> 56);
+    }
+
+    static bool is_number(std::uint64_t word) {
+        tape_type type = type_at(word);
+        return type == tape_type::INT64 || type == tape_type::UINT64 ||
+               type == tape_type::DOUBLE;
+    }
+
+    std::uint64_t string(std::size_t ix) const {
+        const std::uint8_t* entry = m_strings +
+                                    (m_tape[ix] & simdjson::internal::JSON_VALUE_MASK);
+        std::uint32_t size;
+        std::memcpy(&size, entry, sizeof(size));
+        return run_kernel<hash_bytes>(reinterpret_cast<const char*>(entry + sizeof(size)),
+                                      size);
+    }
+
+    std::uint64_t array(std::size_t ix, std::size_t end) const {
+        std::uint64_t sum = 0;
+        std::uint64_t position = 0;
+        while (ix < end) {
+            if (is_number(m_tape[ix])) {
+                std::size_t run_end = ix;
+                while (run_end < end && is_number(m_tape[run_end])) {
+                    run_end += 2;
+                }
+                std::size_t n_pairs = (run_end - ix) / 2;
+                sum += run_kernel<hash_tape_pairs>(m_tape + ix, n_pairs, position);
+                position += n_pairs;
+                ix = run_end;
+            }
+            else {
+                sum += hash_mix(element(ix) + position * hash_position_salt);
+                ++position;
+            }
+        }
+        return hash_mix(sum ^ hash_mix(position ^ array_tag));
+    }
+
+    std::uint64_t object(std::size_t ix, std::size_t end) const {
+        std::uint64_t sum = 0;
+        std::uint64_t size = 0;
+        while (ix < end) {
+            std::uint64_t key = string(ix++);
+            sum += hash_mix(key + hash_mix(element(ix)));
+            ++size;
+        }
+        return hash_mix(sum ^ hash_mix(size ^ object_tag));
+    }
+
+public:
+    explicit tape_hasher(const simdjson::dom::document& document)
+        : m_tape(document.tape.get()), m_strings(document.string_buf.get()) {}
+
+    /** Hash the value at tape index ``ix`` and advance ``ix`` past it.
+     */
+    std::uint64_t element(std::size_t& ix) const {
+        std::uint64_t word = m_tape[ix];
+        switch (type_at(word)) {
+        case tape_type::START_ARRAY: {
+            std::size_t end = static_cast<std::uint32_t>(word);
+            std::uint64_t out = array(ix + 1, end - 1);
+            ix = end;
+            return out;
+        }
+        case tape_type::START_OBJECT: {
+            std::size_t end = static_cast<std::uint32_t>(word);
+            std::uint64_t out = object(ix + 1, end - 1);
+            ix = end;
+            return out;
+        }
+        case tape_type::STRING:
+            return hash_mix(string(ix++) ^ (word >> 56));
+        case tape_type::INT64:
+        case tape_type::UINT64:
+        case tape_type::DOUBLE:
+            ix += 2;
+            return hash_tape_number(word, m_tape[ix - 1]);
+        default:
+            // true, false and null are the whole word
+            ++ix;
+            return hash_mix(word);
+        }
+    }
+};
+
+/** Whether every byte of ``data`` is ASCII.
+
+    The bytes are or'd together a word at a time with no early exit, which compilers
+    turn into a vector loop.
+ */
+inline bool is_ascii(std::string_view data) {
+    const char* it = data.data();
+    const char* end = it + data.size();
+    std::uint64_t bits = 0;
+    for (; end - it >= 8; it += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, it, sizeof(word));
+        bits |= word;
+    }
+    for (; it != end; ++it) {
+        bits |= static_cast<unsigned char>(*it);
+    }
+    return !(bits & 0x8080808080808080ULL);
+}
+
+/** Build a ``str`` from a string on the tape, which simdjson has already validated as
+    UTF-8. ASCII strings are copied straight into a compact ``str`` without running the
+    UTF-8 decoder.
+ */
+inline py::owned_ref<> decode_string(std::string_view data) {
+    if (is_ascii(data)) {
+        py::owned_ref<> out{PyUnicode_New(data.size(), 127)};
+        if (!out) {
+            throw py::exception{};
+        }
+        std::memcpy(PyUnicode_1BYTE_DATA(out.get()), data.data(), data.size());
+        return out;
+    }
+    py::owned_ref<> out{PyUnicode_DecodeUTF8(data.data(), data.size(), nullptr)};
+    if (!out) {
+        throw py::exception{};
+    }
+    return out;
+}
+
+/** Convert a JSON string to ``str`` if ``decode_strings`` is set, otherwise to ``bytes``.
+ */
+inline py::owned_ref<> string_to_object(std::string_view data, bool decode_strings) {
+    return decode_strings ? decode_string(data) : py::to_object(data);
+}
+
+/** Convert a scalar element to a Python object.
+ */
+inline py::owned_ref<> scalar_to_object(simdjson::dom::element element,
+                                        bool decode_strings) {
+    if (decode_strings && element.type() == simdjson::dom::element_type::STRING) {
+        return decode_string(std::string_view(element));
+    }
+    return py::to_object(element);
+}
+
+/** Converts elements into plain Python objects for a single ``as_dict``, ``as_list``,
+    ``keys``, ``values`` or ``items`` call.
+
+    Arrays of records repeat the same few keys many times, so short keys are cached by
+    content and every occurrence shares one Python object. Besides saving the
+    allocations, the shared object's hash is only computed once when it is inserted
+    into each dict.
+ */
+class object_converter {
+private:
+    // long keys are rarely repeated; don't let unique keys grow the cache unbounded
+    static constexpr std::size_t max_cached_key_size = 64;
+    static constexpr std::size_t max_cached_keys = 4096;
+
+    // the views point into the document's string buffer, which outlives the converter
+    std::unordered_map<std::string_view, py::owned_ref<>> m_keys;
+
+    bool m_decode_strings;
+
+public:
+    explicit object_converter(bool decode_strings) : m_decode_strings(decode_strings) {}
+
+    py::owned_ref<> key(std::string_view key) {
+        if (key.size() > max_cached_key_size) {
+            return string_to_object(key, m_decode_strings);
+        }
+        auto it = m_keys.find(key);
+        if (it != m_keys.end()) {
+            return py::owned_ref<>::new_reference(it->second.get());
+        }
+        // keys come from untrusted input, so they are not interned: interned strings
+        // are immortal from Python 3.12 on, and a stream of unique keys would leak
+        py::owned_ref<> ob = string_to_object(key, m_decode_strings);
+        if (m_keys.size() < max_cached_keys) {
+            m_keys.emplace(key, py::owned_ref<>::new_reference(ob.get()));
+        }
+        return ob;
+    }
+
+    py::owned_ref<> operator()(simdjson::dom::element element) {
+        switch (element.type()) {
+        case simdjson::dom::element_type::ARRAY:
+            return (*this)(simdjson::dom::array(element));
+        case simdjson::dom::element_type::OBJECT:
+            return (*this)(simdjson::dom::object(element));
+        default:
+            return scalar_to_object(element, m_decode_strings);
+        }
+    }
+
+    py::owned_ref<> operator()(simdjson::dom::array array) {
+        py::owned_ref<> out{PyList_New(array.size())};
+        if (!out) {
+            throw py::exception{};
+        }
+        Py_ssize_t ix = 0;
+        for (simdjson::dom::element value : array) {
+            PyList_SET_ITEM(out.get(), ix++, std::move((*this)(value)).escape());
+        }
+        return out;
+    }
+
+    py::owned_ref<> operator()(simdjson::dom::object object) {
+        py::owned_ref<> out{PyDict_New()};
+        if (!out) {
+            throw py::exception{};
+        }
+        for (auto [k, v] : object) {
+            if (PyDict_SetItem(out.get(), key(k).get(), (*this)(v).get())) {
+                throw py::exception{};
+            }
+        }
+        return out;
+    }
+
+    py::owned_ref<> item(const simdjson::dom::key_value_pair& item) {
+        py::owned_ref<> out{PyTuple_New(2)};
+        if (!out) {
+            throw py::exception{};
+        }
+        PyTuple_SET_ITEM(out.get(), 0, std::move(key(item.key)).escape());
+        PyTuple_SET_ITEM(out.get(), 1, std::move((*this)(item.value)).escape());
+        return out;
+    }
+};
+
+/** A copy of some JSON text followed by ``SIMDJSON_PADDING`` bytes of slack.
+
+    simdjson may read past the end of its input, so an arbitrary buffer has to be copied
+    into a padded allocation before every parse. Callers that parse the same bytes
+    repeatedly, or that assemble their input themselves, can pay that copy once by
+    building a ``PaddedBuffer`` and passing it to ``loads``.
+ */
+class padded_buffer {
+private:
+    simdjson::padded_string m_data;
+
+public:
+    explicit padded_buffer(std::string_view data) : m_data(data) {}
+
+    std::string_view view() const {
+        return m_data;
+    }
+
+    std::size_t size() const {
+        return m_data.size();
+    }
+};
+
+/** The ``PaddedBuffer`` type, borrowed from the module once it is initialized.
+ */
+inline PyTypeObject* padded_buffer_type = nullptr;
+
+/** The ``Pointer`` type, borrowed from the module once it is initialized.
+ */
+inline PyTypeObject* pointer_type = nullptr;
+
+/** The ``Object`` and ``Array`` types, borrowed from the module once it is initialized.
+ */
+inline PyTypeObject* object_type = nullptr;
+inline PyTypeObject* array_type = nullptr;
+
+/** A read-only view of the JSON text passed to ``loads``.
+
+    The view points directly into the Python object's memory: ``bytes``, ``bytearray``,
+    ``memoryview``, ``mmap`` or anything else exporting a contiguous buffer, a ``str``
+    (through its cached UTF-8 representation), or a ``PaddedBuffer``. Buffer exporters
+    are pinned and the object is referenced for the lifetime of the view, so the memory
+    stays valid while the GIL is released.
+ */
+class input_buffer {
+private:
+    py::owned_ref<> m_object;
+    py::buffer m_buffer;
+    std::string_view m_view;
+    bool m_padded = false;
+
+public:
+    explicit input_buffer(py::borrowed_ref<> ob)
+        : m_object(py::owned_ref<>::new_reference(ob)), m_buffer(nullptr) {
+        if (padded_buffer_type && PyObject_TypeCheck(ob.get(), padded_buffer_type)) {
+            m_view = py::autoclass<padded_buffer>::unbox(ob).view();
+            m_padded = true;
+        }
+        else if (PyUnicode_Check(ob.get())) {
+            Py_ssize_t size;
+            const char* data = PyUnicode_AsUTF8AndSize(ob.get(), &size);
+            if (!data) {
+                throw py::exception{};
+            }
+            m_view = std::string_view(data, size);
+        }
+        else {
+            m_buffer = py::get_buffer(ob, PyBUF_SIMPLE);
+            m_view = std::string_view(static_cast<const char*>(m_buffer->buf),
+                                      m_buffer->len);
+        }
+    }
+
+    const char* data() const {
+        return m_view.data();
+    }
+
+    std::size_t size() const {
+        return m_view.size();
+    }
+
+    /** Whether at least ``SIMDJSON_PADDING`` readable bytes follow the view.
+     */
+    bool padded() const {
+        return m_padded;
+    }
+};
+
+/** A read-only, private mapping of a file followed by at least ``SIMDJSON_PADDING``
+    zero bytes.
+
+    The mapping is placed at the start of a slightly larger anonymous reservation. Bytes
+    past the end of the file on its last page read as zero, and if that slack is smaller
+    than the padding the following anonymous page supplies the rest, so the contents
+    never have to be copied to satisfy simdjson.
+
+    Pipes, character devices and files under ``/proc`` cannot be mapped and report no
+    size, so anything but a regular file is read into a padded buffer instead.
+ */
+class mapped_file {
+private:
+    void* m_reservation = nullptr;
+    std::size_t m_reservation_size = 0;
+    std::size_t m_size = 0;
+    struct free_deleter {
+        void operator()(char* p) const {
+            std::free(p);
+        }
+    };
+
+    // the contents of a file that is not a regular file, followed by simdjson's padding
+    std::unique_ptr<char, free_deleter> m_contents;
+
+    // identity of the mapped file, used to decide whether a mapping can be reused
+    std::string m_path;
+    dev_t m_device = 0;
+    ino_t m_inode = 0;
+    struct timespec m_mtime = {};
+
+    void unmap() {
+        if (m_reservation) {
+            munmap(m_reservation, m_reservation_size);
+        }
+        m_reservation = nullptr;
+        m_reservation_size = 0;
+        m_size = 0;
+        m_contents.reset();
+        m_path.clear();
+    }
+
+    /** Read ``fd`` to its end into ``m_contents``.
+
+        The data is read straight into a padded buffer that grows with ``realloc``, so
+        it is parsed in place like a mapping.
+
+        @return 0 on success, otherwise the ``errno`` describing the failure.
+     */
+    int read_contents(int fd) {
+        constexpr std::size_t padding = simdjson::SIMDJSON_PADDING;
+        std::size_t capacity = 1 << 16;
+        std::size_t size = 0;
+        std::unique_ptr<char, free_deleter> contents{
+            static_cast<char*>(std::malloc(capacity + padding))};
+        if (!contents) {
+            return ENOMEM;
+        }
+        while (true) {
+            if (size == capacity) {
+                capacity *= 2;
+                auto* grown =
+                    static_cast<char*>(std::realloc(contents.get(), capacity + padding));
+                if (!grown) {
+                    return ENOMEM;
+                }
+                contents.release();
+                contents.reset(grown);
+            }
+            ssize_t n = ::read(fd, contents.get() + size, capacity - size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            if (n == 0) {
+                break;
+            }
+            size += n;
+        }
+        std::memset(contents.get() + size, 0, padding);
+        m_contents = std::move(contents);
+        m_size = size;
+        return 0;
+    }
+
+    static struct timespec modification_time(const struct stat& st) {
+#ifdef __APPLE__
+        return st.st_mtimespec;
+#else
+        return st.st_mtim;
+#endif
+    }
+
+    bool same_file(const struct stat& st) const {
+        struct timespec mtime = modification_time(st);
+        return st.st_dev == m_device && st.st_ino == m_inode &&
+               mtime.tv_sec == m_mtime.tv_sec && mtime.tv_nsec == m_mtime.tv_nsec &&
+               std::size_t(st.st_size) == m_size;
+    }
+
+public:
+    mapped_file() = default;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+        unmap();
+    }
+
+    void close() {
+        unmap();
+    }
+
+    const char* data() const {
+        // an empty file has nothing to map, but simdjson still wants padded input
+        static const char empty[simdjson::SIMDJSON_PADDING] = {};
+        if (m_reservation) {
+            return static_cast<const char*>(m_reservation);
+        }
+        return m_contents ? m_contents.get() : empty;
+    }
+
+    std::size_t size() const {
+        return m_size;
+    }
+
+    /** Check whether this already maps the current contents of ``path``.
+     */
+    bool is_current(const std::string& path) const {
+        if (path.empty() || path != m_path) {
+            return false;
+        }
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0 && same_file(st);
+    }
+
+    /** Replace the current mapping with a mapping of ``path``.
+
+        @return 0 on success, otherwise the ``errno`` describing the failure.
+     */
+    int open(const std::string& path) {
+        unmap();
+
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return errno;
+        }
+
+        int err = 0;
+        struct stat st;
+        if (fstat(fd, &st)) {
+            err = errno;
+        }
+        else if (!S_ISREG(st.st_mode)) {
+            // ``m_path`` stays empty: the contents may differ on every read, so they
+            // are never reused
+            err = read_contents(fd);
+            ::close(fd);
+            return err;
+        }
+        else if (st.st_size > 0) {
+            std::size_t size = st.st_size;
+            std::size_t page_size = sysconf(_SC_PAGESIZE);
+            std::size_t padded_size = size + simdjson::SIMDJSON_PADDING;
+            std::size_t reservation_size =
+                (padded_size + page_size - 1) / page_size * page_size;
+
+            void* reservation = mmap(nullptr,
+                                     reservation_size,
+                                     PROT_READ,
+                                     MAP_PRIVATE | MAP_ANONYMOUS,
+                                     -1,
+                                     0);
+            if (reservation == MAP_FAILED) {
+                err = errno;
+            }
+            else if (mmap(reservation,
+                          size,
+                          PROT_READ,
+                          MAP_PRIVATE | MAP_FIXED,
+                          fd,
+                          0) == MAP_FAILED) {
+                err = errno;
+                munmap(reservation, reservation_size);
+            }
+            else {
+                m_reservation = reservation;
+                m_reservation_size = reservation_size;
+                m_size = size;
+            }
+        }
+
+        ::close(fd);
+        if (!err) {
+            m_path = path;
+            m_device = st.st_dev;
+            m_inode = st.st_ino;
+            m_mtime = modification_time(st);
+        }
+        return err;
+    }
+};
+
+using namespace py::cs::literals;
+
+class document_stream;
+class parser_pool;
+struct detached_document;
+
+using decode_strings_arg = py::arg::opt_keyword<decltype("decode_strings"_cs), bool>;
+
+using default_arg = py::arg::opt_keyword<decltype("default"_cs), py::borrowed_ref<>>;
+
+using depth_arg = py::arg::opt_keyword<decltype("depth"_cs), std::size_t>;
+
+using structural_only_arg = py::arg::opt_keyword<decltype("structural_only"_cs), bool>;
+
+using keep_mapped_arg = py::arg::opt_keyword<decltype("keep_mapped"_cs), bool>;
+
+/** The sizes of the buffers of a document, and of a ``dom::parser``'s stage 1 and
+    stage 2 state, for a given capacity. These mirror ``dom::document::allocate`` and
+    the implementations' ``set_capacity`` and ``set_max_depth``.
+ */
+struct buffer_sizes {
+    static std::size_t tape_words(std::size_t capacity) {
+        return SIMDJSON_ROUNDUP_N(capacity + 3, 64);
+    }
+
+    static std::size_t string_bytes(std::size_t capacity) {
+        return SIMDJSON_ROUNDUP_N(5 * capacity / 3 + simdjson::SIMDJSON_PADDING, 64);
+    }
+
+    static std::size_t document_bytes(std::size_t capacity) {
+        return tape_words(capacity) * sizeof(std::uint64_t) + string_bytes(capacity);
+    }
+
+    static std::size_t parser_bytes(std::size_t capacity, std::size_t max_depth) {
+        // the structural indexes, then a tape index and count plus an is-array flag
+        // for each level of nesting
+        std::size_t structural_indexes = SIMDJSON_ROUNDUP_N(capacity, 64) + 2 + 7;
+        return structural_indexes * sizeof(std::uint32_t) +
+               max_depth * (2 * sizeof(std::uint32_t) + sizeof(bool));
+    }
+
+    /** The words of ``doc``'s tape that hold the parsed document.
+     */
+    static std::size_t used_tape_words(const simdjson::dom::document& doc) {
+        // the root word holds the index just past the matching root word at the end
+        return doc.tape[0] & simdjson::internal::JSON_VALUE_MASK;
+    }
+
+    /** The bytes of ``doc``'s string buffer that the parsed document uses.
+     */
+    static std::size_t used_string_bytes(const simdjson::dom::document& doc) {
+        namespace tape = simdjson::internal;
+        std::vector<std::size_t> pending;
+        std::size_t last = last_string(doc.tape.get(), 1, pending);
+        if (!last) {
+            return 0;
+        }
+        // strings are appended in tape order, each as a 32 bit length, the bytes and a
+        // NUL, so the last one marks how much was used
+        std::size_t offset = doc.tape[last] & tape::JSON_VALUE_MASK;
+        std::uint32_t length;
+        std::memcpy(&length, doc.string_buf.get() + offset, sizeof(length));
+        return offset + sizeof(length) + length + 1;
+    }
+
+private:
+    /** The tape index of the last string in the value at ``ix``, or 0 if it holds none.
+
+        Rather than walk every word, this steps over the members of a container,
+        jumping over nested ones, and then descends only into the containers after its
+        last direct string, starting from the last.
+
+        @param pending Scratch space for the containers still to be searched.
+     */
+    static std::size_t last_string(const std::uint64_t* tape,
+                                   std::size_t ix,
+                                   std::vector<std::size_t>& pending) {
+        using simdjson::internal::tape_type;
+        auto type_at = [&](std::size_t at) {
+            return static_cast<tape_type>(tape[at] >> 56);
+        };
+        switch (type_at(ix)) {
+        case tape_type::STRING:
+            return ix;
+        case tape_type::START_ARRAY:
+        case tape_type::START_OBJECT:
+            break;
+        default:
+            return 0;
+        }
+
+        std::size_t end = static_cast<std::uint32_t>(tape[ix]) - 1;
+        std::size_t base = pending.size();
+        std::size_t found = 0;
+        for (ix = ix + 1; ix < end;) {
+            switch (type_at(ix)) {
+            case tape_type::STRING:
+                found = ix++;
+                pending.resize(base);
+                break;
+            case tape_type::START_ARRAY:
+            case tape_type::START_OBJECT:
+                pending.push_back(ix);
+                ix = static_cast<std::uint32_t>(tape[ix]);
+                break;
+            case tape_type::INT64:
+            case tape_type::UINT64:
+            case tape_type::DOUBLE:
+                ix += 2;
+                break;
+            default:
+                ++ix;
+            }
+        }
+        while (pending.size() > base) {
+            std::size_t child = pending.back();
+            pending.pop_back();
+            if (std::size_t nested = last_string(tape, child, pending)) {
+                pending.resize(base);
+                return nested;
+            }
+        }
+        return found;
+    }
+
+};
+
+/** Allocate buffers for ``doc`` sized for a ``dom::parser`` with the given capacity.
+
+    ``dom::document::allocate`` is private to ``dom::parser``; this mirrors its sizing.
+ */
+inline simdjson::error_code allocate_document(simdjson::dom::document& doc,
+                                              std::size_t capacity) {
+    std::size_t string_bytes = buffer_sizes::string_bytes(capacity);
+    doc.string_buf.reset(new (std::nothrow) uint8_t[string_bytes]);
+    doc.tape.reset(new (std::nothrow) uint64_t[buffer_sizes::tape_words(capacity)]);
+    return doc.string_buf && doc.tape ? simdjson::SUCCESS : simdjson::MEMALLOC;
+}
+
+/** Copy the part of ``from``'s tape and string buffer that its document uses into new
+    buffers for ``to``, sized to fit.
+
+    @param bytes Set to the size of the new buffers.
+ */
+inline simdjson::error_code copy_document(const simdjson::dom::document& from,
+                                          simdjson::dom::document& to,
+                                          std::size_t& bytes) {
+    std::size_t tape_words = buffer_sizes::used_tape_words(from);
+    std::size_t string_bytes = buffer_sizes::used_string_bytes(from);
+    to.tape.reset(new (std::nothrow) uint64_t[tape_words]);
+    to.string_buf.reset(new (std::nothrow) uint8_t[string_bytes]);
+    if (!to.tape || !to.string_buf) {
+        return simdjson::MEMALLOC;
+    }
+    std::memcpy(to.tape.get(), from.tape.get(), tape_words * sizeof(std::uint64_t));
+    std::memcpy(to.string_buf.get(), from.string_buf.get(), string_bytes);
+    bytes = tape_words * sizeof(std::uint64_t) + string_bytes;
+    return simdjson::SUCCESS;
+}
+
+/** The name of ``error``'s ``simdjson::error_code`` enumerator, e.g. ``"TAPE_ERROR"``.
+ */
+inline const char* error_code_name(simdjson::error_code error) {
+    switch (error) {
+#define LIBPY_SIMDJSON_ERROR_CODE(name)                                                  \
+    case simdjson::name:                                                                 \
+        return #name;
+        LIBPY_SIMDJSON_ERROR_CODE(SUCCESS)
+        LIBPY_SIMDJSON_ERROR_CODE(CAPACITY)
+        LIBPY_SIMDJSON_ERROR_CODE(MEMALLOC)
+        LIBPY_SIMDJSON_ERROR_CODE(TAPE_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(DEPTH_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(STRING_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(T_ATOM_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(F_ATOM_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(N_ATOM_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(NUMBER_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(UTF8_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(UNINITIALIZED)
+        LIBPY_SIMDJSON_ERROR_CODE(EMPTY)
+        LIBPY_SIMDJSON_ERROR_CODE(UNESCAPED_CHARS)
+        LIBPY_SIMDJSON_ERROR_CODE(UNCLOSED_STRING)
+        LIBPY_SIMDJSON_ERROR_CODE(UNSUPPORTED_ARCHITECTURE)
+        LIBPY_SIMDJSON_ERROR_CODE(INCORRECT_TYPE)
+        LIBPY_SIMDJSON_ERROR_CODE(NUMBER_OUT_OF_RANGE)
+        LIBPY_SIMDJSON_ERROR_CODE(INDEX_OUT_OF_BOUNDS)
+        LIBPY_SIMDJSON_ERROR_CODE(NO_SUCH_FIELD)
+        LIBPY_SIMDJSON_ERROR_CODE(IO_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(INVALID_JSON_POINTER)
+        LIBPY_SIMDJSON_ERROR_CODE(INVALID_URI_FRAGMENT)
+        LIBPY_SIMDJSON_ERROR_CODE(UNEXPECTED_ERROR)
+        LIBPY_SIMDJSON_ERROR_CODE(PARSER_IN_USE)
+#undef LIBPY_SIMDJSON_ERROR_CODE
+    default:
+        return "UNEXPECTED_ERROR";
+    }
+}
+
+/** Counters describing the documents parsed by one parser, or by every parser.
+
+    Counters are updated without the GIL by whichever thread is parsing, so they are
+    atomic; each one is individually exact, but a snapshot taken during a parse may
+    mix values from before and after it.
+ */
+struct parse_stats {
+    static constexpr bool supported = LIBPY_SIMDJSON_STATS;
+
+    enum counter {
+        documents,
+        bytes,
+        structural_indexes,
+        tape_words,
+        string_bytes,
+        // time spent copying input to add padding, in stage 1, in stage 2, and
+        // building Python objects from the tape
+        copy_ns,
+        stage1_ns,
+        stage2_ns,
+        convert_ns,
+        n_counters,
+    };
+
+    static constexpr const char* names[n_counters] = {
+        "documents",
+        "bytes",
+        "structural_indexes",
+        "tape_words",
+        "string_bytes",
+        "copy_ns",
+        "stage1_ns",
+        "stage2_ns",
+        "convert_ns",
+    };
+
+    using sample = std::array<std::uint64_t, n_counters>;
+
+    std::array<std::atomic<std::uint64_t>, n_counters> counters{};
+
+    /** A monotonic clock which reads as zero when ``on`` is false.
+     */
+    class stopwatch {
+    private:
+        bool m_on;
+        std::chrono::steady_clock::time_point m_last;
+
+    public:
+        explicit stopwatch(bool on) : m_on(supported && on) {
+            if (m_on) {
+                m_last = std::chrono::steady_clock::now();
+            }
+        }
+
+        /** The nanoseconds since construction or the previous lap.
+         */
+        std::uint64_t lap() {
+            if (!m_on) {
+                return 0;
+            }
+            auto now = std::chrono::steady_clock::now();
+            auto elapsed = now - std::exchange(m_last, now);
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+    };
+
+    /** Fill in the counters describing a successfully parsed document.
+
+        Finding the string bytes used takes a walk of the tape that is not counted in
+        any timer. It steps over containers without reading them, but reads every
+        scalar of a container holding no strings after them, e.g. an array of numbers.
+     */
+    static void
+    describe_document(sample& out,
+                      std::size_t size,
+                      const simdjson::internal::dom_parser_implementation& impl,
+                      const simdjson::dom::document& doc) {
+        out[documents] = 1;
+        out[bytes] = size;
+        out[structural_indexes] = impl.n_structural_indexes;
+        out[tape_words] = buffer_sizes::used_tape_words(doc);
+        out[string_bytes] = buffer_sizes::used_string_bytes(doc);
+    }
+
+    void add(const sample& values) {
+        for (std::size_t ix = 0; ix < n_counters; ++ix) {
+            counters[ix].fetch_add(values[ix], std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for (auto& counter : counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    py::owned_ref<> to_dict() const {
+        py::owned_ref<> out{PyDict_New()};
+        if (!out) {
+            throw py::exception{};
+        }
+        for (std::size_t ix = 0; ix < n_counters; ++ix) {
+            py::owned_ref<> value =
+                py::to_object(counters[ix].load(std::memory_order_relaxed));
+            if (PyDict_SetItemString(out.get(), names[ix], value.get())) {
+                throw py::exception{};
+            }
+        }
+        return out;
+    }
+};
+
+/** The totals over every parser that collects statistics.
+ */
+inline parse_stats global_stats;
+
+/** Whether the parsers behind the module level functions collect statistics.
+ */
+inline std::atomic<bool> default_parsers_collect_stats{false};
+
+class parser : public std::enable_shared_from_this<parser> {
+private:
+    simdjson::dom::parser m_parser;
+
+    // The simdjson implementation ``m_parser.implementation`` was created from, which
+    // is replaced when ``set_implementation`` picks a different one.
+    const simdjson::implementation* m_kernel = nullptr;
+
+    // The file most recently passed to ``load(..., keep_mapped=True)``, kept mapped so
+    // that reloading it does not need to map it again.
+    mapped_file m_mapped_file;
+
+    // Held while the GIL is released around a parse so that two Python threads sharing
+    // one ``Parser`` cannot both write into ``m_parser`` at the same time.
+    std::mutex m_parse_mutex;
+
+    // The buffers of a detached document that nothing refers to anymore, swapped back
+    // into ``m_parser`` by the next ``detach_document`` instead of allocating new ones.
+    // At most one is kept, so a parser whose results are dropped retains up to twice
+    // ``document_bytes``; ``shrink`` frees it.
+    simdjson::dom::document m_spare_document;
+    std::size_t m_spare_capacity = 0;
+    // the capacity ``m_parser.doc``'s buffers were allocated for, which may exceed
+    // ``m_parser.capacity()`` when they came from the spare document
+    std::size_t m_document_capacity = 0;
+    // the buffers of the detached documents that are still alive
+    std::atomic<std::size_t> m_live_document_bytes{0};
+    // documents larger than this are freed instead, so that ``shrink`` sticks
+    std::size_t m_spare_limit = std::numeric_limits<std::size_t>::max();
+    std::mutex m_spare_mutex;
+
+    // The size of the input most recently passed to ``parse_input``.
+    std::size_t m_parsed_size = 0;
+
+    // Whether JSON strings become ``str`` rather than ``bytes``.
+    bool m_decode_strings = false;
+
+    // Whether parses and conversions are counted in ``m_stats`` and ``global_stats``.
+    // Results read it to time conversions, possibly on another thread than the one
+    // setting it.
+    std::atomic<bool> m_collect_stats{false};
+    parse_stats m_stats;
+
+    // Set while a ``document_stream`` is using ``m_parser``; its stage 1 results live in
+    // ``m_parser`` between documents, so nothing else may parse with it until it is done.
+    bool m_streaming = false;
+
+    std::unique_lock<std::mutex> lock_for_parse();
+
+    std::unique_lock<std::mutex> try_lock_parser();
+
+    // The following never touch Python objects, so they may run without the GIL. The
+    // caller must hold ``m_parse_mutex``.
+
+    /** Parse the file at ``path`` into ``m_parser.doc``.
+
+        The document does not refer back to its input, so the file is unmapped once it
+        has been parsed unless ``keep_mapped`` is set. A mapping that is kept pins the
+        file's disk space even after it is deleted, and truncating the file while it is
+        mapped makes reading the lost pages raise ``SIGBUS``.
+
+        @param error Set to the result of the parse.
+        @param keep_mapped Whether to keep the mapping for the next ``parse_file`` of
+               the same, unchanged file.
+        @return 0, or the ``errno`` describing why the file could not be mapped.
+     */
+    int
+    parse_file(const std::string& path, simdjson::error_code& error, bool keep_mapped);
+
+    /** Parse ``in_buffer`` into ``m_parser.doc``.
+     */
+    simdjson::error_code parse_buffer(const input_buffer& in_buffer);
+
+    /** Run only stage 1 over ``in_buffer``, finding its structural characters and
+        checking its strings and UTF-8 without building a tape.
+     */
+    simdjson::error_code scan_buffer(const input_buffer& in_buffer);
+
+    /** Allocate ``m_parser`` with the active simdjson implementation, replacing its
+        implementation if it was created from another one.
+     */
+    simdjson::error_code reallocate(std::size_t capacity, std::size_t max_depth);
+
+    /** Grow ``m_parser`` for a document of ``size`` bytes the way
+        ``dom::parser::parse`` would, also switching to the active implementation.
+     */
+    simdjson::error_code ensure_capacity(std::size_t size);
+
+    /** Run stage 1 and stage 2 over ``size`` bytes at ``data``, timing each stage.
+
+        @param copy Whether ``data`` lacks the padding simdjson needs and must be copied.
+     */
+    simdjson::error_code parse_input(const char* data, std::size_t size, bool copy);
+
+    /** Take the most recently parsed document out of ``m_parser``.
+
+        A document that is small for the parser's capacity, or that came from a
+        document stream, is copied into buffers sized to fit, so that keeping it does
+        not keep buffers sized for the largest input the parser has seen. Otherwise the
+        document's buffers are handed over whole and replaced with the spare document
+        or, if there is none, newly allocated buffers.
+
+        @return The document, or nullptr if the buffers could not be allocated.
+     */
+    std::shared_ptr<detached_document> detach_document();
+
+    void recycle_document(simdjson::dom::document&& doc, std::size_t capacity);
+
+    /** Convert the most recently parsed document, detaching it first so that it stays
+        valid through later parses. Requires the GIL and ``m_parse_mutex``.
+     */
+    py::owned_ref<> detach_result();
+
+    friend class document_stream;
+    friend class parser_pool;
+    friend struct detached_document;
+
+public:
+    explicit parser(bool decode_strings = false, bool collect_stats = false)
+        : m_decode_strings(decode_strings), m_collect_stats(collect_stats) {}
+
+    std::shared_ptr<parser> getptr() {
+        return shared_from_this();
+    }
+
+    bool decode_strings() const {
+        return m_decode_strings;
+    }
+
+    /** The size of the largest document this parser has buffers for.
+     */
+    std::size_t capacity() const {
+        return m_parser.capacity();
+    }
+
+    /** Count later parses in ``stats``. Parses and conversions already under way on
+        other threads may or may not be counted.
+     */
+    void set_collect_stats(bool collect_stats) {
+        m_collect_stats.store(collect_stats, std::memory_order_relaxed);
+    }
+
+    bool collect_stats() const {
+        return m_collect_stats.load(std::memory_order_relaxed);
+    }
+
+    const parse_stats& stats() const {
+        return m_stats;
+    }
+
+    /** Call ``f``, counting the time it takes to build Python objects.
+     */
+    template<typename F>
+    py::owned_ref<> timed_conversion(F&& f) {
+        parse_stats::stopwatch watch(collect_stats());
+        py::owned_ref<> out = f();
+        if (std::uint64_t elapsed = watch.lap()) {
+            parse_stats::sample values{};
+            values[parse_stats::convert_ns] = elapsed;
+            m_stats.add(values);
+            global_stats.add(values);
+        }
+        return out;
+    }
+
+    /** Set the largest document this parser will grow its buffers for.
+     */
+    void set_max_capacity(std::size_t max_capacity);
+
+    /** Allocate buffers for documents of up to ``capacity`` bytes nested at most
+        ``max_depth`` levels deep, so that parsing them does not allocate.
+     */
+    void allocate(std::size_t capacity, std::size_t max_depth);
+
+    /** Release buffers beyond what documents of up to ``capacity`` bytes need,
+        including the spare document and the mapping of the last loaded file.
+     */
+    void shrink(std::size_t capacity);
+
+    /** The bytes this parser has allocated, as a dict.
+     */
+    py::owned_ref<> memory_usage();
+
+    using capacity_arg = py::arg::opt_keyword<decltype("capacity"_cs), std::size_t>;
+    using max_depth_arg = py::arg::opt_keyword<decltype("max_depth"_cs), std::size_t>;
+
+    static void allocate_method(const std::shared_ptr<parser>& p,
+                                std::size_t capacity,
+                                max_depth_arg max_depth) {
+        p->allocate(capacity, max_depth.get().value_or(p->m_parser.max_depth()));
+    }
+
+    static void shrink_method(const std::shared_ptr<parser>& p, capacity_arg capacity) {
+        p->shrink(capacity.get().value_or(0));
+    }
+
+    static std::size_t capacity_method(const std::shared_ptr<parser>& p) {
+        return p->capacity();
+    }
+
+    static std::size_t max_capacity_method(const std::shared_ptr<parser>& p) {
+        return p->m_parser.max_capacity();
+    }
+
+    static std::size_t max_depth_method(const std::shared_ptr<parser>& p) {
+        return p->m_parser.max_depth();
+    }
+
+    static py::owned_ref<> memory_usage_method(const std::shared_ptr<parser>& p) {
+        return p->memory_usage();
+    }
+
+    /** The name of the simdjson implementation this parser's buffers are laid out
+        for, which it parses with until ``set_implementation`` picks another, or None
+        if it has not allocated yet.
+     */
+    static py::owned_ref<> implementation_method(const std::shared_ptr<parser>& p);
+
+    static py::owned_ref<> stats_method(const std::shared_ptr<parser>& p) {
+        return p->m_stats.to_dict();
+    }
+
+    static void reset_stats_method(const std::shared_ptr<parser>& p) {
+        p->m_stats.reset();
+    }
+
+    py::owned_ref<> load(const std::filesystem::path& filename, bool keep_mapped);
+
+    py::owned_ref<> loads(const input_buffer& in_buffer);
+
+    /** The outcome of ``validate``.
+     */
+    struct validation {
+        simdjson::error_code error = simdjson::SUCCESS;
+        // where the error was found, when simdjson reports it
+        std::optional<std::size_t> offset;
+
+        py::owned_ref<> to_object() const;
+    };
+
+    /** Check whether ``in_buffer`` holds a single valid JSON document within this
+        parser's limits, without building any Python objects.
+
+        @param structural_only Only run stage 1, which checks strings and UTF-8 but not
+               the grammar or the scalars.
+     */
+    validation validate(const input_buffer& in_buffer, bool structural_only);
+
+    static py::owned_ref<> validate_method(const std::shared_ptr<parser>& p,
+                                           py::borrowed_ref<> in_buffer,
+                                           structural_only_arg structural_only) {
+        return p->validate(input_buffer{in_buffer},
+                           structural_only.get().value_or(false))
+            .to_object();
+    }
+
+    static py::owned_ref<> load_method(const std::shared_ptr<parser>& p,
+                                       const std::filesystem::path& filename,
+                                       keep_mapped_arg keep_mapped) {
+        return p->load(filename, keep_mapped.get().value_or(false));
+    }
+
+    py::owned_ref<> load_many(const std::filesystem::path& filename,
+                              std::size_t batch_size);
+
+    py::owned_ref<> parse_many(input_buffer&& in_buffer, std::size_t batch_size);
+
+    static py::owned_ref<> loads_method(const std::shared_ptr<parser>& p,
+                                        py::borrowed_ref<> in_buffer) {
+        return p->loads(input_buffer{in_buffer});
+    }
+
+    using batch_size_arg = py::arg::opt_keyword<decltype("batch_size"_cs), std::size_t>;
+
+    static py::owned_ref<> load_many_method(const std::shared_ptr<parser>& p,
+                                            const std::filesystem::path& filename,
+                                            batch_size_arg batch_size) {
+        return p->load_many(filename,
+                            batch_size.get().value_or(
+                                simdjson::dom::DEFAULT_BATCH_SIZE));
+    }
+
+    static py::owned_ref<> parse_many_method(const std::shared_ptr<parser>& p,
+                                             py::borrowed_ref<> in_buffer,
+                                             batch_size_arg batch_size) {
+        return p->parse_many(input_buffer{in_buffer},
+                             batch_size.get().value_or(
+                                 simdjson::dom::DEFAULT_BATCH_SIZE));
+    }
+};
+
+/** An open addressing hash table over the members of one wide object, so that repeated
+    lookups in it do not compare against every key.
+ */
+class object_index {
+private:
+    struct entry {
+        std::string_view key;
+        simdjson::dom::element value;
+    };
+
+    std::vector<entry> m_entries;
+    // indices into ``m_entries`` plus one; zero marks an empty slot
+    std::vector<std::uint32_t> m_slots;
+    std::size_t m_mask;
+
+    /** The slot holding ``key``, or the empty slot where it belongs.
+     */
+    std::size_t probe(std::string_view key) const {
+        std::size_t slot = std::hash<std::string_view>{}(key) & m_mask;
+        while (m_slots[slot] && m_entries[m_slots[slot] - 1].key != key) {
+            slot = (slot + 1) & m_mask;
+        }
+        return slot;
+    }
+
+public:
+    explicit object_index(simdjson::dom::object object) {
+        std::size_t n_slots = 1;
+        while (n_slots < 2 * object.size()) {
+            n_slots <<= 1;
+        }
+        m_slots.assign(n_slots, 0);
+        m_mask = n_slots - 1;
+        m_entries.reserve(object.size());
+        for (auto it = object.begin(); it != object.end(); ++it) {
+            std::size_t slot = probe(it.key());
+            if (m_slots[slot]) {
+                // like ``at_key``, the first of any duplicate keys wins
+                continue;
+            }
+            m_entries.push_back({it.key(), it.value()});
+            m_slots[slot] = m_entries.size();
+        }
+    }
+
+    simdjson::simdjson_result<simdjson::dom::element> find(std::string_view key) const {
+        std::uint32_t ix = m_slots[probe(key)];
+        if (!ix) {
+            return simdjson::NO_SUCH_FIELD;
+        }
+        simdjson::dom::element value = m_entries[ix - 1].value;
+        return value;
+    }
+};
+
+/** A parsed document which has been taken out of its parser so that the parser can
+    move on to the next document while this one is still referenced.
+
+    Objects and Arrays built from it share ownership of it; when the last of them is
+    dropped the buffers are offered back to the parser.
+ */
+struct detached_document {
+    std::shared_ptr<parser> owner;
+    // the capacity the buffers were allocated for, or 0 if they were sized to fit the
+    // document and are too small to parse into
+    std::size_t capacity;
+    // the size of the buffers, counted in the owner's ``m_live_document_bytes``
+    std::size_t bytes;
+    simdjson::dom::document document;
+
+    // Objects with at least ``index_min_size`` members get an ``object_index`` once
+    // they have been looked up ``index_after_lookups`` times; below that a scan is
+    // cheaper than building the table.
+    static constexpr std::size_t index_min_size = 32;
+    static constexpr std::size_t index_after_lookups = 4;
+
+    struct lazy_index {
+        std::size_t lookups = 0;
+        std::unique_ptr<object_index> index;
+    };
+
+    // Keyed by the first key of the object, which no other object in the document
+    // shares. Only touched with the GIL held.
+    std::unordered_map<const char*, lazy_index> object_indexes;
+
+    // Structural hashes of the objects and arrays that have been hashed, keyed by tape
+    // index. Only touched with the GIL held.
+    std::unordered_map<std::size_t, std::uint64_t> digests;
+
+    detached_document(std::shared_ptr<parser> owner, std::size_t capacity)
+        : detached_document(std::move(owner),
+                            capacity,
+                            buffer_sizes::document_bytes(capacity)) {}
+
+    detached_document(std::shared_ptr<parser> owner,
+                      std::size_t capacity,
+                      std::size_t bytes)
+        : owner(std::move(owner)), capacity(capacity), bytes(bytes) {
+        this->owner->m_live_document_bytes += bytes;
+    }
+
+    ~detached_document() {
+        owner->m_live_document_bytes -= bytes;
+        if (capacity) {
+            owner->recycle_document(std::move(document), capacity);
+        }
+    }
+
+    bool decode_strings() const {
+        return owner->decode_strings();
+    }
+
+    /** Look up ``key`` in ``object``, an object in this document.
+     */
+    simdjson::simdjson_result<simdjson::dom::element> find(simdjson::dom::object object,
+                                                           std::string_view key) {
+        if (object.size() < index_min_size) {
+            return object.at_key(key);
+        }
+        lazy_index& entry = object_indexes[object.begin().key().data()];
+        if (!entry.index) {
+            if (++entry.lookups < index_after_lookups) {
+                return object.at_key(key);
+            }
+            entry.index = std::make_unique<object_index>(object);
+        }
+        return entry.index->find(key);
+    }
+
+    /** The structural hash of ``value``, an object or array in this document.
+     */
+    template<typename T>
+    std::uint64_t digest(T value) {
+        std::size_t ix = tape_access::index(value);
+        auto [it, inserted] = digests.try_emplace(ix);
+        if (inserted) {
+            it->second = tape_hasher{document}.element(ix);
+        }
+        return it->second;
+    }
+};
+
+class pointer_trie;
+
+/** A JSON Pointer (RFC 6901) split into its reference tokens once, so that it can be
+    resolved against many documents without tokenizing and unescaping it each time.
+
+    Resolution follows ``dom::element::at_pointer``, including its error codes.
+ */
+class json_pointer {
+private:
+    struct token {
+        // the token with ``~0`` and ``~1`` unescaped, used to index objects
+        std::string key;
+        // the array index the token names, valid when ``index_error`` is ``SUCCESS``
+        std::size_t index = 0;
+        simdjson::error_code index_error = simdjson::SUCCESS;
+    };
+
+    std::string m_text;
+    std::vector<token> m_tokens;
+
+    friend class pointer_trie;
+
+    /** Parse one reference token, both as an object key and as an array index.
+
+        @return ``INVALID_JSON_POINTER`` if the token contains an invalid escape.
+     */
+    static simdjson::error_code parse_token(std::string_view raw, token& out) {
+        out.key.reserve(raw.size());
+        for (std::size_t ix = 0; ix < raw.size(); ++ix) {
+            if (raw[ix] != '~') {
+                out.key.push_back(raw[ix]);
+                continue;
+            }
+            if (ix + 1 == raw.size() || (raw[ix + 1] != '0' && raw[ix + 1] != '1')) {
+                return simdjson::INVALID_JSON_POINTER;
+            }
+            out.key.push_back(raw[++ix] == '0' ? '~' : '/');
+        }
+
+        bool digits = std::all_of(raw.begin(), raw.end(), [](char c) {
+            return c >= '0' && c <= '9';
+        });
+        if (raw == "-") {
+            // the position after the last element, which never exists
+            out.index_error = simdjson::INDEX_OUT_OF_BOUNDS;
+        }
+        else if (!digits) {
+            out.index_error = simdjson::INCORRECT_TYPE;
+        }
+        else if (raw.empty() || (raw.size() > 1 && raw[0] == '0')) {
+            out.index_error = simdjson::INVALID_JSON_POINTER;
+        }
+        else if (raw.size() > std::numeric_limits<std::size_t>::digits10) {
+            out.index_error = simdjson::INDEX_OUT_OF_BOUNDS;
+        }
+        else {
+            for (char c : raw) {
+                out.index = out.index * 10 + (c - '0');
+            }
+        }
+        return simdjson::SUCCESS;
+    }
+
+public:
+    /** Split ``text`` into tokens.
+
+        @return ``INVALID_JSON_POINTER`` if ``text`` is not a JSON Pointer.
+     */
+    simdjson::error_code compile(std::string_view text) {
+        m_text = text;
+        m_tokens.clear();
+        if (text.empty()) {
+            return simdjson::SUCCESS;
+        }
+        if (text[0] != '/') {
+            return simdjson::INVALID_JSON_POINTER;
+        }
+        std::size_t start = 1;
+        while (true) {
+            std::size_t end = text.find('/', start);
+            std::string_view raw = end == std::string_view::npos
+                                       ? text.substr(start)
+                                       : text.substr(start, end - start);
+            if (auto error = parse_token(raw, m_tokens.emplace_back())) {
+                m_tokens.clear();
+                return error;
+            }
+            if (end == std::string_view::npos) {
+                return simdjson::SUCCESS;
+            }
+            start = end + 1;
+        }
+    }
+
+    const std::string& text() const {
+        return m_text;
+    }
+
+    std::size_t size() const {
+        return m_tokens.size();
+    }
+
+private:
+    static simdjson::simdjson_result<simdjson::dom::element>
+    step(simdjson::dom::object object, const token& t) {
+        return object.at_key(t.key);
+    }
+
+    static simdjson::simdjson_result<simdjson::dom::element>
+    step(simdjson::dom::array array, const token& t) {
+        if (t.index_error) {
+            return t.index_error;
+        }
+        return array.at(t.index);
+    }
+
+    static simdjson::simdjson_result<simdjson::dom::element>
+    step(simdjson::dom::element element, const token& t) {
+        switch (element.type()) {
+        case simdjson::dom::element_type::OBJECT:
+            return step(simdjson::dom::object(element), t);
+        case simdjson::dom::element_type::ARRAY:
+            return step(simdjson::dom::array(element), t);
+        default:
+            return simdjson::INVALID_JSON_POINTER;
+        }
+    }
+
+public:
+    /** Resolve the pointer against an element, object or array.
+     */
+    template<typename T>
+    simdjson::simdjson_result<simdjson::dom::element> resolve(T value) const {
+        if (m_tokens.empty()) {
+            // the value itself, which only simdjson can turn back into an element
+            return value.at_pointer("");
+        }
+        simdjson::dom::element element;
+        if (auto error = step(value, m_tokens.front()).get(element)) {
+            return error;
+        }
+        for (auto it = std::next(m_tokens.begin()); it != m_tokens.end(); ++it) {
+            if (auto error = step(element, *it).get(element)) {
+                return error;
+            }
+        }
+        return element;
+    }
+};
+
+/** Collect the items of a Python iterable.
+ */
+inline std::vector<py::owned_ref<>> to_vector(py::borrowed_ref<> iterable) {
+    py::owned_ref<> it{PyObject_GetIter(iterable.get())};
+    if (!it) {
+        throw py::exception{};
+    }
+    std::vector<py::owned_ref<>> out;
+    while (py::owned_ref<> item{PyIter_Next(it.get())}) {
+        out.push_back(std::move(item));
+    }
+    if (PyErr_Occurred()) {
+        throw py::exception{};
+    }
+    return out;
+}
+
+/** The text of an object key or pointer given as ``str`` or ``bytes``, without copying.
+ */
+inline std::string_view text_view(py::borrowed_ref<> ob) {
+    if (PyUnicode_Check(ob.get())) {
+        Py_ssize_t size;
+        const char* data = PyUnicode_AsUTF8AndSize(ob.get(), &size);
+        if (!data) {
+            throw py::exception{};
+        }
+        return std::string_view(data, size);
+    }
+    return py::from_object<std::string_view>(ob);
+}
+
+inline bool is_pointer(py::borrowed_ref<> ob) {
+    return pointer_type && PyObject_TypeCheck(ob.get(), pointer_type);
+}
+
+/** The text of ``pointer``, a ``Pointer`` or the text of one, for error messages.
+ */
+inline std::string_view pointer_text(py::borrowed_ref<> pointer) {
+    if (is_pointer(pointer)) {
+        return py::autoclass<json_pointer>::unbox(pointer).text();
+    }
+    return text_view(pointer);
+}
+
+/** Resolve ``pointer``, a ``Pointer`` or the text of one, against ``value``.
+ */
+template<typename T>
+simdjson::simdjson_result<simdjson::dom::element>
+resolve_pointer(py::borrowed_ref<> pointer, T value) {
+    if (is_pointer(pointer)) {
+        return py::autoclass<json_pointer>::unbox(pointer).resolve(value);
+    }
+    json_pointer compiled;
+    if (auto error = compiled.compile(text_view(pointer))) {
+        return error;
+    }
+    return compiled.resolve(value);
+}
+
+inline json_pointer make_pointer(py::borrowed_ref<> text) {
+    json_pointer out;
+    if (out.compile(text_view(text))) {
+        throw py::exception(PyExc_ValueError, "invalid JSON pointer: ", text_view(text));
+    }
+    return out;
+}
+
+/** Several JSON Pointers merged into a prefix tree, so that all of them can be
+    resolved in one walk over a document: every object or array on a shared prefix is
+    scanned once, however many of the pointers pass through it.
+ */
+class pointer_trie {
+private:
+    struct node {
+        // the indices of the pointers that end at this node
+        std::vector<std::size_t> outputs;
+        std::unordered_map<std::string_view, std::size_t> by_key;
+        std::unordered_map<std::size_t, std::size_t> by_index;
+        std::size_t max_index = 0;
+    };
+
+    // the keys point into the tokens of the pointers, which outlive the trie
+    std::vector<node> m_nodes;
+    std::size_t m_size = 0;
+
+    using result_type = std::vector<std::optional<simdjson::dom::element>>;
+
+    void walk(simdjson::dom::object object,
+              std::size_t ix,
+              result_type& out,
+              std::vector<bool>& visited) const {
+        const node& n = m_nodes[ix];
+        std::size_t remaining = n.by_key.size();
+        for (auto it = object.begin(); remaining && it != object.end(); ++it) {
+            auto child = n.by_key.find(it.key());
+            // like ``at_key``, only the first of any duplicate keys is used
+            if (child != n.by_key.end() && !visited[child->second]) {
+                visited[child->second] = true;
+                --remaining;
+                walk(it.value(), child->second, out, visited);
+            }
+        }
+    }
+
+    void walk(simdjson::dom::array array,
+              std::size_t ix,
+              result_type& out,
+              std::vector<bool>& visited) const {
+        const node& n = m_nodes[ix];
+        if (n.by_index.empty()) {
+            return;
+        }
+        std::size_t index = 0;
+        for (auto it = array.begin(); index <= n.max_index && it != array.end();
+             ++it, ++index) {
+            auto child = n.by_index.find(index);
+            if (child != n.by_index.end()) {
+                visited[child->second] = true;
+                walk(*it, child->second, out, visited);
+            }
+        }
+    }
+
+    void walk(simdjson::dom::element element,
+              std::size_t ix,
+              result_type& out,
+              std::vector<bool>& visited) const {
+        for (std::size_t output : m_nodes[ix].outputs) {
+            out[output] = element;
+        }
+        switch (element.type()) {
+        case simdjson::dom::element_type::OBJECT:
+            walk(simdjson::dom::object(element), ix, out, visited);
+            break;
+        case simdjson::dom::element_type::ARRAY:
+            walk(simdjson::dom::array(element), ix, out, visited);
+            break;
+        default:
+            break;
+        }
+    }
+
+public:
+    explicit pointer_trie(const std::vector<const json_pointer*>& pointers)
+        : m_nodes(1), m_size(pointers.size()) {
+        for (std::size_t output = 0; output < pointers.size(); ++output) {
+            std::size_t ix = 0;
+            for (const json_pointer::token& t : pointers[output]->m_tokens) {
+                auto [it, inserted] = m_nodes[ix].by_key.try_emplace(t.key,
+                                                                     m_nodes.size());
+                std::size_t child = it->second;
+                if (inserted) {
+                    if (!t.index_error) {
+                        m_nodes[ix].by_index.emplace(t.index, child);
+                        m_nodes[ix].max_index = std::max(m_nodes[ix].max_index, t.index);
+                    }
+                    m_nodes.emplace_back();
+                }
+                ix = child;
+            }
+            m_nodes[ix].outputs.push_back(output);
+        }
+    }
+
+    /** Resolve every pointer against ``value``, an object or array.
+
+        @return The element each pointer names, or nullopt where it names nothing.
+     */
+    template<typename T>
+    result_type resolve(T value) const {
+        result_type out(m_size);
+        if (!m_nodes[0].outputs.empty()) {
+            // an empty pointer always resolves to the value itself
+            simdjson::dom::element root = value.at_pointer("").first;
+            for (std::size_t output : m_nodes[0].outputs) {
+                out[output] = root;
+            }
+        }
+        std::vector<bool> visited(m_nodes.size());
+        walk(value, 0, out, visited);
+        return out;
+    }
+};
+
+/** Adapts an iterator over part of a document so that dereferencing it yields Python
+    objects, converted with ``to_python(value, decode_strings)``.
+ */
+template<typename Iterator, auto to_python>
+class python_iterator {
+private:
+    Iterator m_it;
+    bool m_decode_strings;
+
+public:
+    python_iterator(Iterator it, bool decode_strings)
+        : m_it(it), m_decode_strings(decode_strings) {}
+
+    py::owned_ref<> operator*() const {
+        return to_python(*m_it, m_decode_strings);
+    }
+
+    python_iterator& operator++() {
+        ++m_it;
+        return *this;
+    }
+
+    bool operator==(const python_iterator& other) const {
+        return !(m_it != other.m_it);
+    }
+
+    bool operator!=(const python_iterator& other) const {
+        return m_it != other.m_it;
+    }
+};
+
+class object_element {
+private:
+    std::shared_ptr<detached_document> m_document;
+    simdjson::dom::object m_value;
+
+public:
+    object_element(std::shared_ptr<detached_document> document,
+                   simdjson::dom::object value)
+        : m_document(std::move(document)), m_value(value) {}
+
+    py::owned_ref<> operator[](py::borrowed_ref<> field);
+
+    py::owned_ref<> at_pointer(py::borrowed_ref<> json_pntr);
+
+    py::owned_ref<> extract(py::borrowed_ref<> json_pntrs, default_arg default_value);
+
+    py::owned_ref<> materialize(depth_arg depth);
+
+    py::owned_ref<> dumps() const {
+        return dump_tape(m_value);
+    }
+
+    void dump(json_writer& out) const {
+        write_tape(out, m_value);
+    }
+
+    py::owned_ref<> items() const {
+        return collect_object([](object_converter& convert, const auto& item) {
+            return convert.item(item);
+        });
+    }
+
+private:
+    static py::owned_ref<> key_to_object(const simdjson::dom::key_value_pair& item,
+                                         bool decode_strings) {
+        return string_to_object(item.key, decode_strings);
+    }
+
+    /** Build a list with one entry per member, all sharing one key cache.
+     */
+    template<typename F>
+    py::owned_ref<> collect_object(F&& f) const {
+        py::owned_ref<> out{PyList_New(m_value.size())};
+        if (!out) {
+            throw py::exception{};
+        }
+        object_converter convert{m_document->decode_strings()};
+        Py_ssize_t ix = 0;
+        for (const simdjson::dom::key_value_pair& item : m_value) {
+            PyList_SET_ITEM(out.get(), ix++, std::move(f(convert, item)).escape());
+        }
+        return out;
+    }
+
+public:
+    py::owned_ref<> keys() const {
+        return collect_object([](object_converter& convert, const auto& item) {
+            return convert.key(item.key);
+        });
+    }
+
+    py::owned_ref<> values() const {
+        return collect_object([](object_converter& convert, const auto& item) {
+            return convert(item.value);
+        });
+    }
+
+    py::owned_ref<> as_dict() const {
+        return m_document->owner->timed_conversion([&] {
+            return object_converter{m_document->decode_strings()}(m_value);
+        });
+    }
+
+    std::size_t size() const {
+        return m_value.size();
+    }
+
+    using iterator = python_iterator<simdjson::dom::object::iterator, key_to_object>;
+
+    iterator begin() const {
+        return {m_value.begin(), m_document->decode_strings()};
+    }
+
+    iterator end() const {
+        return {m_value.end(), m_document->decode_strings()};
+    }
+
+    bool operator==(const object_element& other) {
+        if (this->size() != other.size()) {
+            return false;
+        }
+
+        return element_eq(this->m_value, other.m_value);
+    }
+
+    /** A hash of the object's contents which agrees with ``==`` and ignores the order
+        of the keys. It is computed from the tape once and cached with the document.
+     */
+    std::uint64_t digest() const {
+        return m_document->digest(m_value);
+    }
+};
+
+/** Copies an array of numbers or bools, or nested arrays of equal length, into a numpy
+    array without boxing each value.
+
+    A first walk over the tape checks that the array is rectangular and records which
+    kinds of values it holds; a second walk writes the values into the numpy array's
+    buffer.
+ */
+class numpy_export {
+public:
+    enum class kind { boolean, int64, uint64, float64 };
+
+    /** Which kinds of numbers and bools have been seen among some values.
+     */
+    struct leaves {
+        bool any_bool = false;
+        bool any_int = false;
+        bool any_negative = false;
+        bool any_uint = false;
+        bool any_double = false;
+
+        // the extremes of the integers, and the largest magnitude of the doubles
+        std::int64_t min_int = 0;
+        std::uint64_t max_int = 0;
+        double max_abs_double = 0;
+
+        /** Record ``value``.
+
+            @return false, recording nothing, if ``value`` is not a number or bool.
+         */
+        bool add(simdjson::dom::element value) {
+            switch (value.type()) {
+            case simdjson::dom::element_type::INT64: {
+                std::int64_t number = value;
+                any_int = true;
+                any_negative |= number < 0;
+                min_int = std::min(min_int, number);
+                if (number > 0) {
+                    max_int = std::max(max_int, std::uint64_t(number));
+                }
+                return true;
+            }
+            case simdjson::dom::element_type::UINT64:
+                any_uint = true;
+                max_int = std::max(max_int, std::uint64_t(value));
+                return true;
+            case simdjson::dom::element_type::DOUBLE:
+                any_double = true;
+                max_abs_double = std::max(max_abs_double, std::fabs(double(value)));
+                return true;
+            case simdjson::dom::element_type::BOOL:
+                any_bool = true;
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        bool mixed() const {
+            return any_bool && (any_int || any_uint || any_double);
+        }
+
+        /** The narrowest kind that holds every value seen, which must not be
+            ``mixed()``.
+         */
+        kind infer() const {
+            if (any_bool) {
+                return kind::boolean;
+            }
+            if (any_double || (any_uint && any_negative)) {
+                return kind::float64;
+            }
+            if (any_uint) {
+                return kind::uint64;
+            }
+            if (any_int) {
+                return kind::int64;
+            }
+            // like ``numpy.array([])``
+            return kind::float64;
+        }
+    };
+
+    static const char* dtype_name(kind k) {
+        switch (k) {
+        case kind::boolean:
+            return "bool";
+        case kind::int64:
+            return "int64";
+        case kind::uint64:
+            return "uint64";
+        default:
+            return "float64";
+        }
+    }
+
+    template<typename T>
+    static T leaf_value(simdjson::dom::element value) {
+        switch (value.type()) {
+        case simdjson::dom::element_type::INT64:
+            return static_cast<T>(std::int64_t(value));
+        case simdjson::dom::element_type::UINT64:
+            return static_cast<T>(std::uint64_t(value));
+        case simdjson::dom::element_type::DOUBLE:
+            return static_cast<T>(double(value));
+        default:
+            return static_cast<T>(bool(value));
+        }
+    }
+
+    /** Call ``numpy.<function>(shape, dtype)``.
+     */
+    static py::owned_ref<>
+    allocate(const char* function, py::borrowed_ref<> shape, const char* dtype) {
+        py::owned_ref<> numpy{PyImport_ImportModule("numpy")};
+        if (!numpy) {
+            throw py::exception{};
+        }
+        py::owned_ref<> out{
+            PyObject_CallMethod(numpy.get(), function, "Os", shape.get(), dtype)};
+        if (!out) {
+            throw py::exception{};
+        }
+        return out;
+    }
+
+private:
+    std::vector<std::size_t> m_shape;
+    leaves m_leaves;
+
+    [[noreturn]] static void throw_ragged() {
+        throw py::exception(PyExc_ValueError,
+                            "cannot convert an Array of unequal length Arrays to numpy");
+    }
+
+    /** Take the shape from the first element at every level.
+     */
+    void infer_shape(simdjson::dom::array array) {
+        while (true) {
+            m_shape.push_back(array.size());
+            if (array.size() == 0 ||
+                (*array.begin()).type() != simdjson::dom::element_type::ARRAY) {
+                return;
+            }
+            array = simdjson::dom::array(*array.begin());
+        }
+    }
+
+    void scan(simdjson::dom::array array, std::size_t depth) {
+        if (array.size() != m_shape[depth]) {
+            throw_ragged();
+        }
+        bool leaf = depth + 1 == m_shape.size();
+        for (simdjson::dom::element value : array) {
+            if (value.type() == simdjson::dom::element_type::ARRAY) {
+                if (leaf) {
+                    throw_ragged();
+                }
+                scan(simdjson::dom::array(value), depth + 1);
+                continue;
+            }
+            if (!leaf) {
+                throw_ragged();
+            }
+            if (!m_leaves.add(value)) {
+                throw py::exception(PyExc_TypeError,
+                                    "to_numpy requires an Array of numbers or bools");
+            }
+        }
+    }
+
+    kind infer_kind() const {
+        if (m_leaves.mixed()) {
+            throw py::exception(PyExc_TypeError,
+                                "cannot infer a dtype for an Array mixing numbers and "
+                                "bools");
+        }
+        return m_leaves.infer();
+    }
+
+    /** Check that every leaf can be written as ``k`` without losing information.
+     */
+    void check_kind(kind k, py::borrowed_ref<> dtype) const {
+        bool ok = false;
+        switch (k) {
+        case kind::boolean:
+            ok = !(m_leaves.any_int || m_leaves.any_uint || m_leaves.any_double);
+            break;
+        case kind::int64:
+            ok = !(m_leaves.any_bool || m_leaves.any_double);
+            break;
+        case kind::uint64:
+            ok = !(m_leaves.any_bool || m_leaves.any_double || m_leaves.any_negative);
+            break;
+        case kind::float64:
+            ok = !m_leaves.any_bool;
+            break;
+        }
+        if (!ok) {
+            throw py::exception(PyExc_TypeError,
+                                "cannot convert the Array's values to dtype ",
+                                dtype);
+        }
+    }
+
+    static kind kind_for(py::borrowed_ref<> dtype) {
+        py::owned_ref<> char_code{PyObject_GetAttrString(dtype.get(), "kind")};
+        if (!char_code) {
+            throw py::exception{};
+        }
+        auto code = py::from_object<std::string>(char_code);
+        if (code == "b") {
+            return kind::boolean;
+        }
+        if (code == "i") {
+            return kind::int64;
+        }
+        if (code == "u") {
+            return kind::uint64;
+        }
+        if (code == "f") {
+            return kind::float64;
+        }
+        throw py::exception(PyExc_TypeError, "to_numpy does not support dtype ", dtype);
+    }
+
+    template<typename T>
+    T* fill(simdjson::dom::array array, T* out) const {
+        for (simdjson::dom::element value : array) {
+            if (value.type() == simdjson::dom::element_type::ARRAY) {
+                out = fill(simdjson::dom::array(value), out);
+            }
+            else {
+                *out++ = leaf_value<T>(value);
+            }
+        }
+        return out;
+    }
+
+    /** Check that every leaf is within the range of ``dtype``, of kind ``k``, so that
+        narrowing to it neither wraps integers nor turns floats into infinities.
+     */
+    void check_range(kind k, py::borrowed_ref<> dtype) const {
+        py::owned_ref<> itemsize{PyObject_GetAttrString(dtype.get(), "itemsize")};
+        if (!itemsize) {
+            throw py::exception{};
+        }
+        std::size_t bits = 8 * py::from_object<std::size_t>(itemsize);
+
+        bool ok = true;
+        switch (k) {
+        case kind::boolean:
+            break;
+        case kind::int64:
+            if (bits < 64) {
+                std::int64_t max = (std::int64_t(1) << (bits - 1)) - 1;
+                ok = m_leaves.min_int >= -max - 1 &&
+                     m_leaves.max_int <= std::uint64_t(max);
+            }
+            else {
+                ok = m_leaves.max_int <=
+                     std::uint64_t(std::numeric_limits<std::int64_t>::max());
+            }
+            break;
+        case kind::uint64:
+            ok = bits >= 64 || m_leaves.max_int < (std::uint64_t(1) << bits);
+            break;
+        case kind::float64: {
+            double max = bits == 16   ? 65504.0
+                         : bits == 32 ? std::numeric_limits<float>::max()
+                                      : std::numeric_limits<double>::infinity();
+            ok = m_leaves.max_abs_double <= max && double(m_leaves.max_int) <= max &&
+                 -double(m_leaves.min_int) <= max;
+            break;
+        }
+        }
+        if (!ok) {
+            throw py::exception(PyExc_OverflowError,
+                                "Array value does not fit in dtype ",
+                                dtype);
+        }
+    }
+
+public:
+    /** Convert ``array`` to a numpy array.
+
+        @param dtype The requested dtype, or nullopt to infer bool, int64, uint64 or
+               float64 from the values.
+     */
+    static py::owned_ref<> convert(simdjson::dom::array array,
+                                   const std::optional<py::borrowed_ref<>>& dtype) {
+        numpy_export self;
+        self.infer_shape(array);
+        self.scan(array, 0);
+
+        py::owned_ref<> requested;
+        kind k;
+        if (dtype) {
+            py::owned_ref<> numpy{PyImport_ImportModule("numpy")};
+            if (!numpy) {
+                throw py::exception{};
+            }
+            requested = py::owned_ref<>{
+                PyObject_CallMethod(numpy.get(), "dtype", "O", dtype->get())};
+            if (!requested) {
+                throw py::exception{};
+            }
+            k = kind_for(requested);
+            self.check_kind(k, requested);
+            self.check_range(k, requested);
+        }
+        else {
+            k = self.infer_kind();
+        }
+
+        py::owned_ref<> out =
+            allocate("empty", py::to_object(self.m_shape), dtype_name(k));
+        {
+            py::buffer buf = py::get_buffer(out, PyBUF_CONTIG);
+            switch (k) {
+            case kind::boolean:
+                self.fill(array, static_cast<bool*>(buf->buf));
+                break;
+            case kind::int64:
+                self.fill(array, static_cast<std::int64_t*>(buf->buf));
+                break;
+            case kind::uint64:
+                self.fill(array, static_cast<std::uint64_t*>(buf->buf));
+                break;
+            case kind::float64:
+                self.fill(array, static_cast<double*>(buf->buf));
+                break;
+            }
+        }
+        if (requested) {
+            // narrower dtypes of the same kind, e.g. float32 or int8, which
+            // ``check_range`` has made sure hold every value
+            out = py::owned_ref<>{PyObject_CallMethod(out.get(),
+                                                      "astype",
+                                                      "OO",
+                                                      requested.get(),
+                                                      Py_False)};
+            if (!out) {
+                throw py::exception{};
+            }
+        }
+        return out;
+    }
+};
+
+/** Splits an array of objects into one typed column per field without creating a
+    Python object per value.
+
+    Each column is a ``(values, valid)`` pair, where ``valid`` is a numpy bool array
+    that is false for rows where the field is null or missing:
+
+    - numbers and bools become a numpy array like ``to_numpy`` would produce;
+    - strings become Arrow-style ``(offsets, data)``: an int64 numpy array of
+      ``len + 1`` offsets into ``data``, a ``bytes`` of the UTF-8 text;
+    - fields holding anything else, or a mix of strings and numbers, fall back to a
+      list of converted Python objects.
+
+    The tape is walked twice: once to choose each column's type and size its
+    buffers, and once to fill them.
+ */
+class column_export {
+private:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    enum class storage { numeric, string, object };
+
+    struct column {
+        std::string_view key;
+        py::owned_ref<> name;
+
+        numpy_export::leaves leaves;
+        bool any_string = false;
+        bool any_other = false;
+        std::size_t string_bytes = 0;
+        // the last row a value was taken from, so that duplicate keys are skipped
+        std::size_t last_row = npos;
+
+        storage store = storage::numeric;
+        numpy_export::kind kind = numpy_export::kind::float64;
+        py::owned_ref<> values;
+        py::owned_ref<> valid;
+        py::owned_ref<> offsets;
+        py::owned_ref<> data;
+        py::buffer values_buffer;
+        py::buffer valid_buffer;
+        py::buffer offsets_buffer;
+        std::size_t data_size = 0;
+    };
+
+    simdjson::dom::array m_array;
+    std::size_t m_rows;
+    bool m_all_fields;
+    std::vector<column> m_columns;
+    std::unordered_map<std::string_view, std::size_t> m_by_key;
+    // Records usually list their keys in the same order, so the column found at each
+    // position in the previous record is tried before hashing the key.
+    std::vector<std::size_t> m_hints;
+
+    std::size_t add_column(std::string_view key, py::owned_ref<> name) {
+        auto [it, inserted] = m_by_key.try_emplace(key, m_columns.size());
+        if (inserted) {
+            column& c = m_columns.emplace_back();
+            c.key = key;
+            c.name = std::move(name);
+        }
+        return it->second;
+    }
+
+    std::size_t find_column(std::string_view key, std::size_t position, bool decode) {
+        if (position < m_hints.size() && m_hints[position] != npos &&
+            m_columns[m_hints[position]].key == key) {
+            return m_hints[position];
+        }
+        std::size_t ix;
+        if (auto it = m_by_key.find(key); it != m_by_key.end()) {
+            ix = it->second;
+        }
+        else if (m_all_fields) {
+            ix = add_column(key, string_to_object(key, decode));
+        }
+        else {
+            ix = npos;
+        }
+        if (position >= m_hints.size()) {
+            m_hints.resize(position + 1, npos);
+        }
+        m_hints[position] = ix;
+        return ix;
+    }
+
+    /** Call ``f(column, row, value)`` for the first value of every selected field in
+        every record.
+     */
+    template<typename F>
+    void for_each_value(bool decode, F&& f) {
+        std::size_t row = 0;
+        for (simdjson::dom::element record : m_array) {
+            if (record.type() != simdjson::dom::element_type::OBJECT) {
+                throw py::exception(PyExc_TypeError,
+                                    "to_columns requires an Array of Objects");
+            }
+            simdjson::dom::object object(record);
+            std::size_t position = 0;
+            for (auto it = object.begin(); it != object.end(); ++it, ++position) {
+                std::size_t ix = find_column(it.key(), position, decode);
+                if (ix == npos || m_columns[ix].last_row == row) {
+                    continue;
+                }
+                m_columns[ix].last_row = row;
+                f(m_columns[ix], row, it.value());
+            }
+            ++row;
+        }
+    }
+
+    static void summarize(column& c, std::size_t, simdjson::dom::element value) {
+        switch (value.type()) {
+        case simdjson::dom::element_type::NULL_VALUE:
+            break;
+        case simdjson::dom::element_type::STRING:
+            c.any_string = true;
+            c.string_bytes += std::string_view(value).size();
+            break;
+        default:
+            if (!c.leaves.add(value)) {
+                c.any_other = true;
+            }
+        }
+    }
+
+    void allocate(column& c) {
+        bool any_leaf = c.leaves.any_bool || c.leaves.any_int || c.leaves.any_uint ||
+                        c.leaves.any_double;
+        if (c.any_other || c.leaves.mixed() || (c.any_string && any_leaf)) {
+            c.store = storage::object;
+        }
+        else if (c.any_string) {
+            c.store = storage::string;
+        }
+        else {
+            c.store = storage::numeric;
+            c.kind = c.leaves.infer();
+        }
+
+        py::owned_ref<> rows = py::to_object(m_rows);
+        c.valid = numpy_export::allocate("zeros", rows, "bool");
+        c.valid_buffer = py::get_buffer(c.valid, PyBUF_CONTIG);
+
+        switch (c.store) {
+        case storage::numeric:
+            c.values = numpy_export::allocate("zeros",
+                                              rows,
+                                              numpy_export::dtype_name(c.kind));
+            c.values_buffer = py::get_buffer(c.values, PyBUF_CONTIG);
+            break;
+        case storage::string:
+            c.offsets = numpy_export::allocate("zeros",
+                                               py::to_object(m_rows + 1),
+                                               "int64");
+            c.offsets_buffer = py::get_buffer(c.offsets, PyBUF_CONTIG);
+            c.data = py::owned_ref<>{PyBytes_FromStringAndSize(nullptr, c.string_bytes)};
+            if (!c.data) {
+                throw py::exception{};
+            }
+            break;
+        case storage::object:
+            c.values = py::owned_ref<>{PyList_New(m_rows)};
+            if (!c.values) {
+                throw py::exception{};
+            }
+            for (std::size_t row = 0; row < m_rows; ++row) {
+                PyList_SET_ITEM(c.values.get(),
+                                row,
+                                py::owned_ref<>::new_reference(Py_None).escape());
+            }
+            break;
+        }
+        c.last_row = npos;
+    }
+
+    template<typename T>
+    static void write_number(column& c, std::size_t row, simdjson::dom::element value) {
+        static_cast<T*>(c.values_buffer->buf)[row] =
+            numpy_export::leaf_value<T>(value);
+    }
+
+    static void fill(column& c,
+                     std::size_t row,
+                     simdjson::dom::element value,
+                     object_converter& convert) {
+        if (value.type() == simdjson::dom::element_type::NULL_VALUE) {
+            return;
+        }
+        static_cast<bool*>(c.valid_buffer->buf)[row] = true;
+        switch (c.store) {
+        case storage::numeric:
+            switch (c.kind) {
+            case numpy_export::kind::boolean:
+                write_number<bool>(c, row, value);
+                break;
+            case numpy_export::kind::int64:
+                write_number<std::int64_t>(c, row, value);
+                break;
+            case numpy_export::kind::uint64:
+                write_number<std::uint64_t>(c, row, value);
+                break;
+            case numpy_export::kind::float64:
+                write_number<double>(c, row, value);
+                break;
+            }
+            break;
+        case storage::string: {
+            std::string_view text(value);
+            std::memcpy(PyBytes_AS_STRING(c.data.get()) + c.data_size,
+                        text.data(),
+                        text.size());
+            c.data_size += text.size();
+            static_cast<std::int64_t*>(c.offsets_buffer->buf)[row + 1] = c.data_size;
+            break;
+        }
+        case storage::object:
+            if (PyList_SetItem(c.values.get(), row, std::move(convert(value)).escape())) {
+                throw py::exception{};
+            }
+            break;
+        }
+    }
+
+    /** Rows without a string repeat the previous offset, giving them no text.
+     */
+    void finish_offsets(column& c) const {
+        auto offsets = static_cast<std::int64_t*>(c.offsets_buffer->buf);
+        auto valid = static_cast<const bool*>(c.valid_buffer->buf);
+        for (std::size_t row = 0; row < m_rows; ++row) {
+            if (!valid[row]) {
+                offsets[row + 1] = offsets[row];
+            }
+        }
+    }
+
+    column_export(simdjson::dom::array array, bool all_fields)
+        : m_array(array), m_rows(array.size()), m_all_fields(all_fields) {}
+
+public:
+    /** Convert ``array`` to a dict of columns.
+
+        @param fields The fields to extract, or nullopt for every field of every record
+               in the order they are first seen.
+     */
+    static py::owned_ref<> convert(simdjson::dom::array array,
+                                   const std::optional<py::borrowed_ref<>>& fields,
+                                   bool decode_strings) {
+        column_export self{array, !fields};
+        std::vector<py::owned_ref<>> names;
+        if (fields) {
+            names = to_vector(*fields);
+            for (const py::owned_ref<>& name : names) {
+                self.add_column(text_view(name),
+                                py::owned_ref<>::new_reference(name.get()));
+            }
+        }
+
+        self.for_each_value(decode_strings, summarize);
+        for (column& c : self.m_columns) {
+            self.allocate(c);
+        }
+        object_converter convert{decode_strings};
+        auto fill_value = [&](column& c, std::size_t row, simdjson::dom::element value) {
+            fill(c, row, value, convert);
+        };
+        self.for_each_value(decode_strings, fill_value);
+
+        py::owned_ref<> out{PyDict_New()};
+        if (!out) {
+            throw py::exception{};
+        }
+        for (column& c : self.m_columns) {
+            py::owned_ref<> values;
+            if (c.store == storage::string) {
+                self.finish_offsets(c);
+                values = py::build_tuple(c.offsets, c.data);
+            }
+            else {
+                values = std::move(c.values);
+            }
+            // release the buffers before handing the arrays out
+            c.values_buffer.reset();
+            c.valid_buffer.reset();
+            c.offsets_buffer.reset();
+            py::owned_ref<> pair = py::build_tuple(values, c.valid);
+            if (PyDict_SetItem(out.get(), c.name.get(), pair.get())) {
+                throw py::exception{};
+            }
+        }
+        return out;
+    }
+};
+
+class array_element {
+private:
+    std::shared_ptr<detached_document> m_document;
+    simdjson::dom::array m_value;
+
+public:
+    array_element(std::shared_ptr<detached_document> document,
+                  simdjson::dom::array value)
+        : m_document(std::move(document)), m_value(value) {}
+
+    py::owned_ref<> at_pointer(py::borrowed_ref<> json_pntr);
+
+    py::owned_ref<> extract(py::borrowed_ref<> json_pntrs, default_arg default_value);
+
+    py::owned_ref<> materialize(depth_arg depth);
+
+    py::owned_ref<> dumps() const {
+        return dump_tape(m_value);
+    }
+
+    void dump(json_writer& out) const {
+        write_tape(out, m_value);
+    }
+
+    py::owned_ref<> operator[](std::ptrdiff_t index);
+
+    py::owned_ref<> as_list() {
+        return m_document->owner->timed_conversion([&] {
+            return object_converter{m_document->decode_strings()}(m_value);
+        });
+    }
+
+    py::owned_ref<>
+    to_numpy(py::arg::opt_keyword<decltype("dtype"_cs), py::borrowed_ref<>> dtype) {
+        return numpy_export::convert(m_value, dtype.get());
+    }
+
+    py::owned_ref<>
+    to_columns(py::arg::opt_keyword<decltype("fields"_cs), py::borrowed_ref<>> fields) {
+        return column_export::convert(m_value,
+                                      fields.get(),
+                                      m_document->decode_strings());
+    }
+
+    std::size_t size() const {
+        return m_value.size();
+    }
+
+private:
+    typedef simdjson::dom::array::iterator iterator;
+
+    static py::owned_ref<> value_to_object(simdjson::dom::element value,
+                                           bool decode_strings) {
+        return object_converter{decode_strings}(value);
+    }
+
+    py::owned_ref<> to_object(simdjson::dom::element value) const {
+        return value_to_object(value, m_document->decode_strings());
+    }
+
+public:
+    using value_iterator = python_iterator<iterator, value_to_object>;
+
+    value_iterator begin() const {
+        return {m_value.begin(), m_document->decode_strings()};
+    }
+
+    value_iterator end() const {
+        return {m_value.end(), m_document->decode_strings()};
+    }
+
+    bool operator==(const array_element& other) {
+        if (this->size() != other.size()) {
+            return false;
+        }
+
+        return element_eq(this->m_value, other.m_value);
+    }
+
+    /** A hash of the array's contents which agrees with ``==``. It is computed from the
+        tape once and cached with the document.
+     */
+    std::uint64_t digest() const {
+        return m_document->digest(m_value);
+    }
+
+private:
+    template<simdjson::dom::element_type type, typename T>
+    std::size_t specialized_count(py::borrowed_ref<> generic_needle,
+                                  T needle,
+                                  iterator it,
+                                  iterator end) const {
+        std::size_t out = 0;
+        for (; it != end; ++it) {
+            const auto& e = *it;
+            if (e.type() != type) {
+                return out + generic_count(generic_needle, it, end);
+            }
+            out += needle == T(e);
+        }
+        return out;
+    }
+
+    std::size_t
+    generic_count(py::borrowed_ref<> needle, iterator it, iterator end) const {
+        std::size_t out = 0;
+        py::object_map_key needle_cmp{needle};
+        for (; it != end; ++it) {
+            py::object_map_key rhs = to_object(*it);
+            if (!rhs) {
+                throw py::exception{};
+            }
+            out += needle_cmp == rhs;
+        }
+        return out;
+    }
+
+    /** The elements' tape words, read as ``(type word, value)`` pairs like the tape's
+        two word numbers.
+
+        @param needle The value to look for, as the bits of the second word.
+        @return The words, or nullptr if the elements cannot all be numbers of ``type``
+                or ``needle`` has more than one representation.
+     */
+    template<simdjson::dom::element_type type, typename T>
+    const std::uint64_t* tape_numbers(T needle,
+                                      std::size_t& n_pairs,
+                                      std::uint64_t& type_word,
+                                      std::uint64_t& value_bits) const {
+        if constexpr (std::is_same_v<T, double>) {
+            if (needle == 0) {
+                // 0.0 and -0.0 compare equal but differ in bits
+                return nullptr;
+            }
+        }
+        const std::uint64_t* tape = tape_access::document(m_value).tape.get();
+        std::size_t begin = tape_access::index(m_value) + 1;
+        // the start word's payload is the index just past the matching end word
+        std::size_t end = std::uint32_t(tape[begin - 1]) - 1;
+        if ((end - begin) % 2) {
+            return nullptr;
+        }
+        n_pairs = (end - begin) / 2;
+        type_word = static_cast<std::uint64_t>(type) << 56;
+        std::memcpy(&value_bits, &needle, sizeof(value_bits));
+        return tape + begin;
+    }
+
+    template<typename T>
+    static constexpr bool is_tape_number = std::is_same_v<T, std::int64_t> ||
+                                           std::is_same_v<T, std::uint64_t> ||
+                                           std::is_same_v<T, double>;
+
+    template<simdjson::dom::element_type type, typename T>
+    std::size_t try_specialized_count(py::borrowed_ref<> needle) const {
+        T converted;
+        try {
+            converted = py::from_object<T>(needle);
+        }
+        catch (const py::invalid_conversion&) {
+            PyErr_Clear();
+            return generic_count(needle, m_value.begin(), m_value.end());
+        }
+        if constexpr (is_tape_number<T>) {
+            std::size_t n_pairs;
+            std::uint64_t type_word;
+            std::uint64_t value_bits;
+            if (const std::uint64_t* words =
+                    tape_numbers<type>(converted, n_pairs, type_word, value_bits)) {
+                std::size_t typed;
+                std::size_t out =
+                    run_kernel<count_tape_pairs>(words,
+                                                 n_pairs,
+                                                 type_word,
+                                                 value_bits,
+                                                 typed);
+                if (typed == n_pairs) {
+                    return out;
+                }
+            }
+        }
+        return specialized_count<type, T>(needle,
+                                          converted,
+                                          m_value.begin(),
+                                          m_value.end());
+    }
+
+    std::size_t count_null() const {
+        std::size_t out = 0;
+        for (const auto& e : m_value) {
+            out += e.type() == simdjson::dom::element_type::NULL_VALUE;
+        }
+        return out;
+    }
+
+    template<simdjson::dom::element_type type, typename T>
+    std::ptrdiff_t specialized_index(py::borrowed_ref<> generic_needle,
+                                     T needle,
+                                     iterator it,
+                                     iterator end,
+                                     std::ptrdiff_t index = 0) const {
+        std::ptrdiff_t out = -1;
+        for (; it != end; ++it) {
+            const auto& e = *it;
+            if (e.type() != type) {
+                return generic_index(generic_needle, it, end, index);
+            }
+            if (needle == T(e)) {
+                out = index;
+                break;
+            }
+            index++;
+        }
+        return out;
+    }
+
+    std::ptrdiff_t
+    generic_index(py::borrowed_ref<> needle, iterator it, iterator end, std::ptrdiff_t index = 0) const {
+        std::size_t out = -1;
+        py::object_map_key needle_cmp{needle};
+        for (; it != end; ++it) {
+            py::object_map_key rhs = to_object(*it);
+            if (!rhs) {
+                throw py::exception{};
+            }
+            if (needle_cmp == rhs) {
+                out = index;
+                break;
+            }
+            index++;
+        }
+        return out;
+    }
+
+    template<simdjson::dom::element_type type, typename T>
+    std::ptrdiff_t try_specialized_index(py::borrowed_ref<> needle) const {
+        T converted;
+        try {
+            converted = py::from_object<T>(needle);
+        }
+        catch (const py::invalid_conversion&) {
+            PyErr_Clear();
+            return generic_index(needle, m_value.begin(), m_value.end());
+        }
+        if constexpr (is_tape_number<T>) {
+            std::size_t n_pairs;
+            std::uint64_t type_word;
+            std::uint64_t value_bits;
+            if (const std::uint64_t* words =
+                    tape_numbers<type>(converted, n_pairs, type_word, value_bits)) {
+                std::size_t ix =
+                    run_kernel<find_tape_pair>(words, n_pairs, type_word, value_bits);
+                if (ix == n_pairs) {
+                    return -1;
+                }
+                if (words[2 * ix] == type_word) {
+                    return ix;
+                }
+                // an element of another type; the ``ix`` before it are numbers that
+                // did not match, so step over them without comparing and let the
+                // general path decide from there
+                return specialized_index<type, T>(needle,
+                                                  converted,
+                                                  std::next(m_value.begin(), ix),
+                                                  m_value.end(),
+                                                  ix);
+            }
+        }
+        return specialized_index<type, T>(needle,
+                                          converted,
+                                          m_value.begin(),
+                                          m_value.end());
+    }
+
+    std::ptrdiff_t index_null() const {
+        std::ptrdiff_t out = -1;
+        for (auto [index, value] : py::enumerate(m_value)) {
+            if (value.type() == simdjson::dom::element_type::NULL_VALUE) {
+                out = index;
+                break;
+            }
+        }
+
+        return out;
+    }
+
+public:
+    std::ptrdiff_t index(py::borrowed_ref<> needle) const {
+        if (size() == 0) {
+            throw py::exception(PyExc_ValueError, "'", needle, "' is not in Array");
+        }
+
+        std::ptrdiff_t out;
+
+        if (needle.get() == Py_None) {
+            out = index_null();
+        }
+
+        switch ((*m_value.begin()).type()) {
+        case simdjson::dom::element_type::INT64:
+            out = try_specialized_index<simdjson::dom::element_type::INT64, std::int64_t>(
+                needle);
+            break;
+        case simdjson::dom::element_type::UINT64:
+            out =
+                try_specialized_index<simdjson::dom::element_type::UINT64, std::uint64_t>(
+                    needle);
+            break;
+        case simdjson::dom::element_type::DOUBLE:
+            out = try_specialized_index<simdjson::dom::element_type::DOUBLE, double>(
+                needle);
+            break;
+        case simdjson::dom::element_type::STRING:
+            out = try_specialized_index<simdjson::dom::element_type::STRING,
+                                        std::string_view>(needle);
+            break;
+        case simdjson::dom::element_type::BOOL:
+            out = try_specialized_index<simdjson::dom::element_type::BOOL, bool>(needle);
+            break;
+        default:
+            out = generic_index(needle, m_value.begin(), m_value.end());
+        }
+        if (out < 0) {
+            throw py::exception(PyExc_ValueError, "'", needle, "' is not in Array");
+        }
+
+        return out;
+    }
+
+    std::size_t count(py::borrowed_ref<> needle) const {
+        if (size() == 0) {
+            return 0;
+        }
+
+        if (needle.get() == Py_None) {
+            return count_null();
+        }
+
+        switch ((*m_value.begin()).type()) {
+        case simdjson::dom::element_type::INT64:
+            return try_specialized_count<simdjson::dom::element_type::INT64,
+                                         std::int64_t>(needle);
+        case simdjson::dom::element_type::UINT64:
+            return try_specialized_count<simdjson::dom::element_type::UINT64,
+                                         std::uint64_t>(needle);
+        case simdjson::dom::element_type::DOUBLE:
+            return try_specialized_count<simdjson::dom::element_type::DOUBLE, double>(
+                needle);
+        case simdjson::dom::element_type::STRING:
+            return try_specialized_count<simdjson::dom::element_type::STRING,
+                                         std::string_view>(needle);
+        case simdjson::dom::element_type::BOOL:
+            return try_specialized_count<simdjson::dom::element_type::BOOL, bool>(needle);
+        default:
+            return generic_count(needle, m_value.begin(), m_value.end());
+        }
+    }
+};
+
+/** ``__hash__`` for ``Object`` and ``Array``, through ``autoclass::hash``.
+ */
+template<typename T>
+struct element_hash {
+    std::size_t operator()(const T& value) const {
+        std::size_t out = value.digest();
+        // -1 is how a ``tp_hash`` slot signals an error
+        return out == std::size_t(-1) ? std::size_t(-2) : out;
+    }
+};
+
+}  // namespace libpy_simdjson
+
+template<>
+struct std::hash<libpy_simdjson::object_element>
+    : libpy_simdjson::element_hash<libpy_simdjson::object_element> {};
+
+template<>
+struct std::hash<libpy_simdjson::array_element>
+    : libpy_simdjson::element_hash<libpy_simdjson::array_element> {};
+
+namespace libpy_simdjson {
+
+inline py::owned_ref<> disambiguate_result(const std::shared_ptr<detached_document>& doc,
+                                           simdjson::dom::element result) {
+    auto result_type = result.type();
+    switch (result_type) {
+    case simdjson::dom::element_type::ARRAY:
+        return py::autoclass<array_element>::construct(doc, result);
+    case simdjson::dom::element_type::OBJECT:
+        return py::autoclass<object_element>::construct(doc, result);
+    default:
+        return scalar_to_object(result, doc->decode_strings());
+    }
+}
+
+inline py::owned_ref<>
+disambiguate_detached(const std::shared_ptr<detached_document>& doc) {
+    return disambiguate_result(doc, doc->document.root());
+}
+
+/** Converts the outer levels of an element into dicts and lists for ``materialize``.
+
+    Containers nested deeper than the requested depth are returned as ``Object`` and
+    ``Array`` proxies sharing the document, so subtrees that are never read are never
+    converted.
+ */
+class shallow_converter {
+private:
+    std::shared_ptr<detached_document> m_document;
+    object_converter m_convert;
+
+public:
+    explicit shallow_converter(std::shared_ptr<detached_document> document)
+        : m_document(std::move(document)), m_convert(m_document->decode_strings()) {}
+
+    /** Convert ``element``.
+
+        @param depth The number of levels of containers to convert, counting
+               ``element`` itself; a container at depth ``0`` is returned as a proxy.
+     */
+    py::owned_ref<> operator()(simdjson::dom::element element, std::size_t depth) {
+        switch (element.type()) {
+        case simdjson::dom::element_type::ARRAY:
+            return (*this)(simdjson::dom::array(element), depth);
+        case simdjson::dom::element_type::OBJECT:
+            return (*this)(simdjson::dom::object(element), depth);
+        default:
+            return scalar_to_object(element, m_document->decode_strings());
+        }
+    }
+
+    py::owned_ref<> operator()(simdjson::dom::array array, std::size_t depth) {
+        if (!depth) {
+            return py::autoclass<array_element>::construct(m_document, array);
+        }
+        py::owned_ref<> out{PyList_New(array.size())};
+        if (!out) {
+            throw py::exception{};
+        }
+        Py_ssize_t ix = 0;
+        for (simdjson::dom::element value : array) {
+            PyList_SET_ITEM(out.get(),
+                            ix++,
+                            std::move((*this)(value, depth - 1)).escape());
+        }
+        return out;
+    }
+
+    py::owned_ref<> operator()(simdjson::dom::object object, std::size_t depth) {
+        if (!depth) {
+            return py::autoclass<object_element>::construct(m_document, object);
+        }
+        py::owned_ref<> out{PyDict_New()};
+        if (!out) {
+            throw py::exception{};
+        }
+        for (auto [k, v] : object) {
+            py::owned_ref<> value = (*this)(v, depth - 1);
+            if (PyDict_SetItem(out.get(), m_convert.key(k).get(), value.get())) {
+                throw py::exception{};
+            }
+        }
+        return out;
+    }
+};
+
+[[noreturn]] inline void throw_io_error(const std::string& path, int err) {
+    throw py::exception(PyExc_ValueError,
+                        simdjson::error_message(simdjson::IO_ERROR),
+                        " ",
+                        path,
+                        ": ",
+                        std::strerror(err));
+}
+
+/** The documents of a buffer holding many whitespace separated JSON documents, such as
+    newline delimited JSON, backed by ``dom::parser::parse_many``.
+
+    Each step parses one document with the GIL released. When simdjson is built with
+    ``SIMDJSON_THREADS_ENABLED``, stage 1 of the next batch runs on a helper thread while
+    the documents of the current batch go through stage 2. Each document is detached from
+    the parser as it is yielded, so it stays valid after the stream moves on; once the
+    yielded objects are dropped its buffers are handed back to the parser.
+ */
+class document_stream {
+private:
+    std::shared_ptr<parser> m_parser;
+
+    // the memory being parsed: the caller's buffer, a padded copy of it, or a mapping
+    std::optional<input_buffer> m_input;
+    simdjson::padded_string m_padded_copy;
+    mapped_file m_mapped_file;
+
+    // ``dom::document_stream::iterator`` refers to its stream, which must not move
+    std::unique_ptr<simdjson::dom::document_stream> m_stream;
+    std::optional<simdjson::dom::document_stream::iterator> m_it;
+
+    // Python iterators dereference and then increment, so the increment is deferred
+    // until the next document is actually requested.
+    bool m_pending_advance = false;
+
+    // once the stream is exhausted it no longer uses the parser
+    bool m_finished = false;
+
+    void start(std::string_view padded_input, std::size_t batch_size) {
+        m_stream = std::make_unique<simdjson::dom::document_stream>();
+        // grow the parser before the stream would, so that it switches implementation
+        // and tracks the size of its document like any other parse
+        auto error = m_parser->ensure_capacity(batch_size);
+        if (!error) {
+            error = m_parser->m_parser
+                        .parse_many(padded_input.data(), padded_input.size(), batch_size)
+                        .get(*m_stream);
+        }
+        if (error) {
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+        }
+        m_parser->m_streaming = true;
+    }
+
+    void finish() {
+        if (!m_finished) {
+            m_finished = true;
+            m_parser->m_streaming = false;
+        }
+    }
+
+    void sync() {
+        if (m_it && !m_pending_advance) {
+            return;
+        }
+        auto lock = m_parser->try_lock_parser();
+        py::gil::release_block released;
+        if (!m_it) {
+            m_it.emplace(m_stream->begin());
+        }
+        else {
+            ++*m_it;
+        }
+        m_pending_advance = false;
+    }
+
+    bool done() {
+        if (m_finished) {
+            return true;
+        }
+        sync();
+        if (!(*m_it != m_stream->end())) {
+            finish();
+        }
+        return m_finished;
+    }
+
+    py::owned_ref<> current() {
+        sync();
+        auto error = (**m_it).error();
+        if (error) {
+            // simdjson stops iterating after the first error
+            finish();
+            throw py::exception(PyExc_ValueError, simdjson::error_message(error));
+        }
+        // stage 2 of the next document will overwrite the parser's document
+        auto lock = m_parser->try_lock_parser();
+        return m_parser->detach_result();
+    }
+
+public:
+    document_stream(std::shared_ptr<parser> parser_pntr,
+                    input_buffer&& in_buffer,
+                    std::size_t batch_size)
+        : m_parser(std::move(parser_pntr)) {
+        std::string_view padded_input;
+        if (in_buffer.padded()) {
+            m_input.emplace(std::move(in_buffer));
+            padded_input = std::string_view(m_input->data(), m_input->size());
+        }
+        else {
+            {
+                py::gil::release_block released;
+                m_padded_copy = simdjson::padded_string(in_buffer.data(),
+                                                        in_buffer.size());
+            }
+            padded_input = m_padded_copy;
+        }
+        start(padded_input, batch_size);
+    }
+
+    document_stream(std::shared_ptr<parser> parser_pntr,
+                    const std::string& path,
+                    std::size_t batch_size)
+        : m_parser(std::move(parser_pntr)) {
+        int err;
+        {
+            py::gil::release_block released;
+            err = m_mapped_file.open(path);
+        }
+        if (err) {
+            throw_io_error(path, err);
+        }
+        start(std::string_view(m_mapped_file.data(), m_mapped_file.size()), batch_size);
+    }
+
+    document_stream(const document_stream&) = delete;
+    document_stream& operator=(const document_stream&) = delete;
+
+    ~document_stream() {
+        finish();
+    }
+
+    class iterator {
+    private:
+        document_stream* m_stream;
+
+        bool at_end() const {
+            return !m_stream || m_stream->done();
+        }
+
+    public:
+        explicit iterator(document_stream* stream) : m_stream(stream) {}
+
+        py::owned_ref<> operator*() const {
+            return m_stream->current();
+        }
+
+        iterator& operator++() {
+            m_stream->m_pending_advance = true;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const {
+            return at_end() == other.at_end();
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    iterator begin() {
+        return iterator{this};
+    }
+
+    iterator end() {
+        return iterator{nullptr};
+    }
+};
+
+/** A fixed set of parsers for parsing batches of documents concurrently.
+
+    ``load_all`` and ``loads_all`` release the GIL and spread a batch over up to
+    ``size()`` native threads, each using its own parser. Every result is detached from
+    the parser that produced it, so a whole batch can be alive at once and the pool can
+    go on to the next batch; each result keeps its parser alive until it is dropped.
+ */
+class parser_pool {
+private:
+    std::vector<std::shared_ptr<parser>> m_parsers;
+
+    struct outcome {
+        std::shared_ptr<detached_document> document;
+        simdjson::error_code error = simdjson::SUCCESS;
+        int os_error = 0;
+    };
+
+    /** Call ``parse(parser, index, os_error)`` for every index in ``[0, count)``,
+        spread over the pool's parsers with the GIL released.
+
+        ``parse`` must not touch Python objects. It returns the simdjson error for the
+        document and may set ``os_error`` when its input cannot be read. Exceptions are
+        caught on the worker and become ``MEMALLOC`` for ``std::bad_alloc`` and
+        ``IO_ERROR`` otherwise.
+     */
+    template<typename F>
+    std::vector<outcome> parse_all(std::size_t count, F&& parse) {
+        std::vector<outcome> outcomes(count);
+        std::atomic<std::size_t> next_index{0};
+
+        auto work = [&](parser& p) {
+            std::lock_guard<std::mutex> lock(p.m_parse_mutex);
+            for (std::size_t ix; (ix = next_index.fetch_add(1)) < count;) {
+                outcome& out = outcomes[ix];
+                // an exception escaping a worker thread would terminate the process
+                try {
+                    out.error = parse(p, ix, out.os_error);
+                    if (!out.error) {
+                        out.document = p.detach_document();
+                        if (!out.document) {
+                            out.error = simdjson::MEMALLOC;
+                        }
+                    }
+                }
+                catch (const std::bad_alloc&) {
+                    out.error = simdjson::MEMALLOC;
+                }
+                catch (...) {
+                    out.error = simdjson::IO_ERROR;
+                }
+            }
+        };
+
+        py::gil::release_block released;
+        std::size_t n_threads = std::min(m_parsers.size(), count);
+        std::vector<std::thread> threads;
+        for (std::size_t ix = 1; ix < n_threads; ++ix) {
+            try {
+                threads.emplace_back(work, std::ref(*m_parsers[ix]));
+            }
+            catch (const std::system_error&) {
+                // make do with the threads we already have
+                break;
+            }
+        }
+        if (n_threads) {
+            work(*m_parsers[0]);
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        return outcomes;
+    }
+
+    static py::owned_ref<> to_list(const std::vector<outcome>& outcomes) {
+        py::owned_ref<> out{PyList_New(outcomes.size())};
+        if (!out) {
+            throw py::exception{};
+        }
+        for (std::size_t ix = 0; ix < outcomes.size(); ++ix) {
+            PyList_SET_ITEM(out.get(),
+                            ix,
+                            std::move(disambiguate_detached(outcomes[ix].document))
+                                .escape());
+        }
+        return out;
+    }
+
+public:
+    parser_pool(std::size_t size, bool decode_strings) {
+        m_parsers.reserve(size);
+        for (std::size_t ix = 0; ix < size; ++ix) {
+            m_parsers.emplace_back(std::make_shared<parser>(decode_strings));
+        }
+    }
+
+    std::size_t size() const {
+        return m_parsers.size();
+    }
+
+    py::owned_ref<> load_all(py::borrowed_ref<> filenames) {
+        std::vector<std::string> paths;
+        for (const auto& filename : to_vector(filenames)) {
+            paths.emplace_back(py::from_object<std::filesystem::path>(filename).string());
+        }
+
+        auto outcomes = parse_all(paths.size(), [&](parser& p, std::size_t ix, int& err) {
+            simdjson::error_code error;
+            err = p.parse_file(paths[ix], error, false);
+            return error;
+        });
+
+        for (std::size_t ix = 0; ix < outcomes.size(); ++ix) {
+            if (outcomes[ix].os_error) {
+                throw_io_error(paths[ix], outcomes[ix].os_error);
+            }
+            if (outcomes[ix].error) {
+                throw py::exception(PyExc_ValueError,
+                                    paths[ix],
+                                    ": ",
+                                    simdjson::error_message(outcomes[ix].error));
+            }
+        }
+        return to_list(outcomes);
+    }
+
+    py::owned_ref<> loads_all(py::borrowed_ref<> in_buffers) {
+        std::vector<input_buffer> buffers;
+        for (const auto& in_buffer : to_vector(in_buffers)) {
+            buffers.emplace_back(in_buffer);
+        }
+
+        auto outcomes = parse_all(buffers.size(), [&](parser& p, std::size_t ix, int&) {
+            return p.parse_buffer(buffers[ix]);
+        });
+
+        for (std::size_t ix = 0; ix < outcomes.size(); ++ix) {
+            if (outcomes[ix].error) {
+                throw py::exception(PyExc_ValueError,
+                                    "document ",
+                                    ix,
+                                    ": ",
+                                    simdjson::error_message(outcomes[ix].error));
+            }
+        }
+        return to_list(outcomes);
+    }
+};
+}  // namespace libpy_simdjson
@@ -1,5 +1,8 @@
+import json
 from pathlib import Path
 
+import pytest
+
 import libpy_simdjson as simdjson
 
 
@@ -11,6 +14,18 @@ def test_as_list(array_element, py_array_element):
     assert actual_list == py_array_element
 
 
+def test_materialize():
+    doc = simdjson.loads(b'[1, [2, [3, [4]]], {"a": [5]}]')
+    assert doc.materialize() == [1, [2, [3, [4]]], {b"a": [5]}]
+
+    shallow = doc.materialize(depth=2)
+    assert shallow[0] == 1
+    assert shallow[1][0] == 2
+    assert isinstance(shallow[1][1], simdjson.Array)
+    assert shallow[1][1].as_list() == [3, [4]]
+    assert isinstance(shallow[2][b"a"], simdjson.Array)
+
+
 def test_len(array_element):
     assert len(array_element) == 24
 
@@ -36,6 +51,28 @@ def test_equality():
     assert elem_1 == elem_2
 
 
+def test_hash():
+    file_path = JSON_FIXTURES_DIR / "small/smalllist.json"
+    elem_1 = simdjson.load(bytes(file_path))
+    elem_2 = simdjson.load(bytes(file_path))
+    assert hash(elem_1) == hash(elem_2)
+    assert elem_1.digest() == elem_2.digest()
+
+    doc = simdjson.loads(b'[[1, 2.5, "x"], [2.5, 1, "x"], [1, 2.5, "x"], [0.0], [-0.0]]')
+    assert hash(doc[0]) == hash(doc[2])
+    assert hash(doc[0]) != hash(doc[1])
+    assert hash(doc[3]) == hash(doc[4])
+    assert set(doc) == {doc[0], doc[1], doc[3]}
+
+    # ints and floats of equal value compare and hash equally, in either order
+    doc = simdjson.loads(b"[[1.0, 2], [1, 2.0], [1, 2]]")
+    for a in doc:
+        for b in doc:
+            assert a == b
+            assert hash(a) == hash(b)
+    assert len(set(doc)) == 1
+
+
 def test_count_specialzied(array_element):
     assert array_element.count(19) == 5
 
@@ -52,3 +89,181 @@ def test_index_specialized(array_element):
 def test_index_generic(heterogeneous_array_element):
     assert heterogeneous_array_element.index(True) == 1
     assert heterogeneous_array_element.index(None) == 2
+
+
+@pytest.mark.parametrize(
+    ["content", "dtype"],
+    [
+        (b"[1, 2, 3]", "int64"),
+        (b"[1, -2, 18446744073709551615]", "float64"),
+        (b"[1, 18446744073709551615]", "uint64"),
+        (b"[1, 2.5]", "float64"),
+        (b"[true, false]", "bool"),
+        (b"[]", "float64"),
+        (b"[[1, 2], [3, 4], [5, 6]]", "int64"),
+        (b"[[[1.5], [2]], [[3], [4]]]", "float64"),
+    ],
+)
+def test_to_numpy(content, dtype):
+    np = pytest.importorskip("numpy")
+
+    expected = np.array(json.loads(content), dtype=dtype)
+    actual = simdjson.loads(content).to_numpy()
+    assert actual.dtype == np.dtype(dtype)
+    np.testing.assert_array_equal(actual, expected)
+
+
+def test_to_numpy_dtype():
+    np = pytest.importorskip("numpy")
+
+    doc = simdjson.loads(b"[[1, 2], [3, 4]]")
+    actual = doc.to_numpy(dtype="float32")
+    assert actual.dtype == np.float32
+    np.testing.assert_array_equal(actual, [[1, 2], [3, 4]])
+
+    with pytest.raises(TypeError):
+        simdjson.loads(b"[1.5]").to_numpy(dtype="int64")
+    with pytest.raises(OverflowError):
+        simdjson.loads(b"[18446744073709551615]").to_numpy(dtype="int64")
+
+
+@pytest.mark.parametrize(
+    "content,dtype",
+    [
+        (b"[-128, 127]", "int8"),
+        (b"[0, 255]", "uint8"),
+        (b"[-32768, 32767]", "int16"),
+        (b"[1.5, -3.4e38]", "float32"),
+        (b"[65504, -1.5]", "float16"),
+    ],
+)
+def test_to_numpy_narrow_dtype(content, dtype):
+    np = pytest.importorskip("numpy")
+
+    doc = simdjson.loads(content)
+    actual = doc.to_numpy(dtype=dtype)
+    assert actual.dtype == np.dtype(dtype)
+    np.testing.assert_array_equal(actual, np.array(doc.as_list(), dtype=dtype))
+
+
+@pytest.mark.parametrize(
+    "content,dtype",
+    [
+        (b"[1, 128]", "int8"),
+        (b"[-129, 1]", "int8"),
+        (b"[256]", "uint8"),
+        (b"[4294967296]", "uint32"),
+        (b"[1e39]", "float32"),
+        (b"[-70000]", "float16"),
+    ],
+)
+def test_to_numpy_narrow_dtype_overflow(content, dtype):
+    pytest.importorskip("numpy")
+
+    with pytest.raises(OverflowError):
+        simdjson.loads(content).to_numpy(dtype=dtype)
+
+
+@pytest.mark.parametrize(
+    "content",
+    [b"[[1, 2], [3]]", b"[[1], 2]", b"[1, [2]]", b'[1, "a"]', b"[1, true]", b"[null]"],
+)
+def test_to_numpy_invalid(content):
+    pytest.importorskip("numpy")
+
+    with pytest.raises((TypeError, ValueError)):
+        simdjson.loads(content).to_numpy()
+
+
+def test_to_numpy_fixture():
+    np = pytest.importorskip("numpy")
+
+    doc = simdjson.load(JSON_FIXTURES_DIR / "numbers.json")
+    np.testing.assert_array_equal(doc.to_numpy(), np.array(doc.as_list()))
+
+
+def test_to_columns():
+    np = pytest.importorskip("numpy")
+
+    records = simdjson.loads(
+        b"""[
+        {"id": 1, "name": "a", "score": 1.5, "ok": true, "tags": [1]},
+        {"name": "bc", "id": 2, "score": null, "ok": false, "extra": 7},
+        {"id": 3, "score": 2, "ok": true, "tags": {"x": 1}, "id": 99}
+    ]"""
+    )
+    columns = records.to_columns()
+    assert list(columns) == [b"id", b"name", b"score", b"ok", b"tags", b"extra"]
+
+    values, valid = columns[b"id"]
+    assert values.dtype == np.int64
+    np.testing.assert_array_equal(values, [1, 2, 3])
+    np.testing.assert_array_equal(valid, [True, True, True])
+
+    (offsets, data), valid = columns[b"name"]
+    np.testing.assert_array_equal(offsets, [0, 1, 3, 3])
+    assert data == b"abc"
+    np.testing.assert_array_equal(valid, [True, True, False])
+
+    values, valid = columns[b"score"]
+    assert values.dtype == np.float64
+    np.testing.assert_array_equal(values[valid], [1.5, 2.0])
+    np.testing.assert_array_equal(valid, [True, False, True])
+
+    values, valid = columns[b"ok"]
+    assert values.dtype == np.bool_
+    np.testing.assert_array_equal(values, [True, False, True])
+
+    values, valid = columns[b"tags"]
+    assert values == [[1], None, {b"x": 1}]
+    np.testing.assert_array_equal(valid, [True, False, True])
+
+    values, valid = columns[b"extra"]
+    np.testing.assert_array_equal(valid, [False, True, False])
+
+
+def test_to_columns_fields():
+    np = pytest.importorskip("numpy")
+
+    records = simdjson.load(JSON_FIXTURES_DIR / "github_events.json")
+    expected = json.loads((JSON_FIXTURES_DIR / "github_events.json").read_bytes())
+
+    columns = records.to_columns(fields=["id", b"public", "missing"])
+    assert list(columns) == ["id", b"public", "missing"]
+
+    (offsets, data), valid = columns["id"]
+    ids = [data[a:b].decode() for a, b in zip(offsets[:-1], offsets[1:])]
+    assert ids == [event["id"] for event in expected]
+    assert valid.all()
+
+    values, valid = columns[b"public"]
+    np.testing.assert_array_equal(values, [event["public"] for event in expected])
+
+    values, valid = columns["missing"]
+    assert len(values) == len(expected)
+    assert not valid.any()
+
+    with pytest.raises(TypeError):
+        simdjson.loads(b"[{}, 1]").to_columns()
+
+
+@pytest.mark.parametrize(
+    "values",
+    [
+        list(range(20)) * 3,
+        [-1, 2**63, 7] * 5,
+        [0.5, -0.0, 0.0, 1e300, 2.25] * 4,
+        [1, 2.0, 1.0, 1, "1", None, True] * 3,
+        # the search resumes after the numbers before the string
+        list(range(20)) + ["a", 25, 19, 20.0],
+    ],
+)
+def test_count_index_numeric(values):
+    doc = simdjson.loads(json.dumps(values).encode())
+    for needle in set(values) | {123456, -0.0, 2.0}:
+        assert doc.count(needle) == values.count(needle), needle
+        if needle in values:
+            assert doc.index(needle) == values.index(needle), needle
+        else:
+            with pytest.raises(ValueError):
+                doc.index(needle)
@@ -1,5 +1,10 @@
 import random
+import subprocess
+import sys
+import tracemalloc
 
+from concurrent.futures import ThreadPoolExecutor
+from json import dumps as json_dumps
 from json import loads as json_loads
 from pathlib import Path
 
@@ -11,21 +16,30 @@ from rapidjson import loads as rapidjson_loads
 from simdjson import loads as pysimdjson_loads
 from simdjson import Parser
 from libpy_simdjson import loads as libpy_simdjson_loads
+from libpy_simdjson import minify as libpy_simdjson_minify
+from libpy_simdjson import implementations as libpy_simdjson_implementations
+from libpy_simdjson import set_implementation as libpy_simdjson_set_implementation
 
 from libpy_simdjson import Array
+from libpy_simdjson import Parser as LibpySimdjsonParser
+from libpy_simdjson import Pointer
 
 
 JSON_FIXTURES_DIR = Path(__file__).parent / "jsonexamples"
 
 
-def libpy_simdjson_as_py_obj(input):
-    doc = libpy_simdjson_loads(input)
+def libpy_simdjson_as_py_obj(input, **kwargs):
+    doc = libpy_simdjson_loads(input, **kwargs)
     if isinstance(doc, Array):
         doc.as_list()
     else:
         doc.as_dict()
 
 
+def libpy_simdjson_as_decoded_py_obj(input):
+    libpy_simdjson_as_py_obj(input, decode_strings=True)
+
+
 pysimdjson_parser = Parser()
 
 
@@ -62,11 +76,236 @@ def test_benchmark_load(group, func, path, benchmark):
         benchmark(func, content)
 
 
+@pytest.mark.slow
+@pytest.mark.parametrize(
+    ["group", "func"],
+    [
+        ("python_json", json_loads),
+        ("orjson", orjson_loads),
+        ("libpy_simdjson_as_py_obj", libpy_simdjson_as_py_obj),
+        ("libpy_simdjson_as_decoded_py_obj", libpy_simdjson_as_decoded_py_obj),
+    ],
+)
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "twitter.json",
+        JSON_FIXTURES_DIR / "citm_catalog.json",
+    ],
+)
+def test_benchmark_as_py_obj(group, func, path, benchmark):
+    benchmark.group = f"Convert to python objects {path}"
+    benchmark.extra_info["group"] = group
+
+    with path.open('rb') as f:
+        content = f.read()
+
+    # repeated keys dominate the allocations of record-heavy documents
+    tracemalloc.start()
+    try:
+        func(content)
+        _, peak = tracemalloc.get_traced_memory()
+    finally:
+        tracemalloc.stop()
+    benchmark.extra_info["peak_allocated_bytes"] = peak
+
+    benchmark(func, content)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["python_json", "libpy_simdjson"])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "twitter.json",
+        JSON_FIXTURES_DIR / "citm_catalog.json",
+        JSON_FIXTURES_DIR / "canada.json",
+    ],
+)
+def test_benchmark_dumps(group, path, benchmark):
+    benchmark.group = f"Serialize a parsed document {path}"
+    benchmark.extra_info["group"] = group
+
+    content = path.read_bytes()
+    if group == "python_json":
+        doc = json_loads(content)
+        benchmark(json_dumps, doc, separators=(",", ":"), ensure_ascii=False)
+    else:
+        benchmark(libpy_simdjson_loads(content).dumps)
+
+
+@pytest.mark.parametrize("group", ["new_parser", "module_loads"])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "small/demo.json",
+        JSON_FIXTURES_DIR / "small/smalldemo.json",
+        JSON_FIXTURES_DIR / "small/truenull.json",
+    ],
+)
+def test_benchmark_small_loads(group, path, benchmark):
+    benchmark.group = f"Small documents {path}"
+    benchmark.extra_info["group"] = group
+
+    content = path.read_bytes()
+    if group == "new_parser":
+        # what the module level loads did before it kept a parser per thread
+        benchmark(lambda: LibpySimdjsonParser().loads(content))
+    else:
+        benchmark(libpy_simdjson_loads, content)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["loads", "validate", "validate_structural_only"])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "small/demo.json",
+        JSON_FIXTURES_DIR / "twitter.json",
+        JSON_FIXTURES_DIR / "canada.json",
+    ],
+)
+def test_benchmark_validate(group, path, benchmark):
+    benchmark.group = f"Validate {path}"
+    benchmark.extra_info["group"] = group
+
+    content = path.read_bytes()
+    parser = LibpySimdjsonParser()
+    if group == "loads":
+        benchmark(parser.loads, content)
+    elif group == "validate":
+        benchmark(parser.validate, content)
+    else:
+        benchmark(parser.validate, content, structural_only=True)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", libpy_simdjson_implementations())
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "canada.json",
+        JSON_FIXTURES_DIR / "twitter.json",
+        JSON_FIXTURES_DIR / "twitterescaped.json",
+        JSON_FIXTURES_DIR / "citm_catalog.json",
+    ],
+)
+def test_benchmark_implementation(group, path, benchmark):
+    benchmark.group = f"Implementation {path}"
+    benchmark.extra_info["group"] = group
+
+    content = path.read_bytes()
+    parser = LibpySimdjsonParser()
+    previous = libpy_simdjson_set_implementation(group)
+    try:
+        benchmark(parser.loads, content)
+    finally:
+        libpy_simdjson_set_implementation(previous)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["python_json", "libpy_simdjson"])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "mesh.pretty.json",
+        JSON_FIXTURES_DIR / "tree-pretty.json",
+    ],
+)
+def test_benchmark_minify(group, path, benchmark):
+    benchmark.group = f"Minify {path}"
+    benchmark.extra_info["group"] = group
+
+    content = path.read_bytes()
+    if group == "python_json":
+
+        def func():
+            json_dumps(json_loads(content), separators=(",", ":"))
+
+        benchmark(func)
+    else:
+        benchmark(libpy_simdjson_minify, content)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["as_dict", "materialize"])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "twitter.json",
+        JSON_FIXTURES_DIR / "github_events.json",
+        JSON_FIXTURES_DIR / "citm_catalog.json",
+    ],
+)
+def test_benchmark_materialize(group, path, benchmark):
+    benchmark.group = f"Convert the top level to python objects {path}"
+    benchmark.extra_info["group"] = group
+
+    doc = libpy_simdjson_loads(path.read_bytes())
+    if group == "as_dict":
+        benchmark(doc.as_dict if hasattr(doc, "as_dict") else doc.as_list)
+    else:
+        benchmark(doc.materialize, depth=2)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["dumps", "hash"])
+@pytest.mark.parametrize(
+    ["path", "pointer"],
+    [
+        (JSON_FIXTURES_DIR / "twitter.json", b"/statuses"),
+        (JSON_FIXTURES_DIR / "github_events.json", b""),
+        (JSON_FIXTURES_DIR / "canada.json", b"/features/0/geometry/coordinates/0"),
+    ],
+)
+def test_benchmark_dedup(group, path, pointer, benchmark):
+    benchmark.group = f"Deduplicate records {path}"
+    benchmark.extra_info["group"] = group
+
+    data = path.read_bytes()
+
+    # hashes are cached with the document, so each round loads it again
+    def dedup():
+        doc = libpy_simdjson_loads(data)
+        records = doc.at_pointer(pointer) if pointer else doc
+        if group == "dumps":
+            return {record.dumps() for record in records}
+        return set(records)
+
+    benchmark(dedup)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["as_list", "to_numpy"])
+@pytest.mark.parametrize(
+    ["path", "pointer"],
+    [
+        (JSON_FIXTURES_DIR / "numbers.json", b""),
+        (JSON_FIXTURES_DIR / "canada.json", b"/features/0/geometry/coordinates/0"),
+        (JSON_FIXTURES_DIR / "mesh.json", b"/positions"),
+    ],
+)
+def test_benchmark_to_numpy(group, path, pointer, benchmark):
+    np = pytest.importorskip("numpy")
+
+    benchmark.group = f"Array to numpy {path}"
+    benchmark.extra_info["group"] = group
+
+    doc = libpy_simdjson_loads(path.read_bytes())
+    array = doc.at_pointer(pointer) if pointer else doc
+
+    if group == "as_list":
+        benchmark(lambda: np.array(array.as_list()))
+    else:
+        benchmark(array.to_numpy)
+
+
 @pytest.mark.parametrize(
     ["group", "read_func"],
     [
         ("python_json", json_loads),
         ("libpy_simdjson", libpy_simdjson_loads),
+        ("libpy_simdjson_compiled_pointer", libpy_simdjson_loads),
     ],
 )
 def test_benchmark_at(group, read_func, benchmark):
@@ -84,8 +323,15 @@ def test_benchmark_at(group, read_func, benchmark):
         selection = random.randrange(100)
         doc["statuses"][selection]["user"]["id"]
 
+    pointers = [Pointer(f"/statuses/{i}/user/id") for i in range(100)]
+
+    def compiled_test_func(doc):
+        doc.at_pointer(pointers[random.randrange(100)])
+
     if group == "libpy_simdjson":
         bench_func = simd_test_func
+    elif group == "libpy_simdjson_compiled_pointer":
+        bench_func = compiled_test_func
     elif group == "python_json":
         bench_func = py_test_func
     else:
@@ -98,6 +344,107 @@ def test_benchmark_at(group, read_func, benchmark):
         benchmark(bench_func, doc)
 
 
+@pytest.mark.parametrize(
+    ["group", "read_func"],
+    [
+        ("python_json", json_loads),
+        ("libpy_simdjson", libpy_simdjson_loads),
+    ],
+)
+@pytest.mark.parametrize("method", ["count", "index"])
+def test_benchmark_numeric_search(group, read_func, method, benchmark):
+    benchmark.group = f"Array.{method} on numbers.json"
+    benchmark.extra_info["group"] = group
+
+    content = (JSON_FIXTURES_DIR / "numbers.json").read_bytes()
+    doc = read_func(content)
+    # the last element, so that index scans the whole array
+    needle = json_loads(content)[-1]
+
+    benchmark(getattr(doc, method), needle)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["as_list", "to_columns"])
+@pytest.mark.parametrize(
+    ["path", "pointer"],
+    [
+        (JSON_FIXTURES_DIR / "twitter.json", b"/statuses"),
+        (JSON_FIXTURES_DIR / "github_events.json", b""),
+    ],
+)
+def test_benchmark_to_columns(group, path, pointer, benchmark):
+    benchmark.group = f"Records to columns {path}"
+    benchmark.extra_info["group"] = group
+
+    doc = libpy_simdjson_loads(path.read_bytes())
+    records = doc.at_pointer(pointer) if pointer else doc
+
+    if group == "as_list":
+        def test_func():
+            rows = records.as_list()
+            fields = dict.fromkeys(key for row in rows for key in row)
+            return {field: [row.get(field) for row in rows] for field in fields}
+
+        benchmark(test_func)
+    else:
+        benchmark(records.to_columns)
+
+
+@pytest.mark.parametrize(
+    ["group", "read_func"],
+    [
+        ("python_json", json_loads),
+        ("libpy_simdjson", libpy_simdjson_loads),
+    ],
+)
+def test_benchmark_wide_object_access(group, read_func, benchmark):
+    benchmark.group = "Random key access in a wide object"
+    benchmark.extra_info["group"] = group
+
+    random.seed(999)
+
+    content = (JSON_FIXTURES_DIR / "update-center.json").read_bytes()
+    plugins = read_func(content)["plugins" if group == "python_json" else b"plugins"]
+    names = list(json_loads(content)["plugins"])
+    if group != "python_json":
+        names = [name.encode() for name in names]
+
+    def test_func():
+        plugins[names[random.randrange(len(names))]]
+
+    benchmark(test_func)
+
+
+@pytest.mark.parametrize("group", ["at_pointer", "extract"])
+def test_benchmark_extract(group, benchmark):
+    benchmark.group = "Extract fields from every event"
+    benchmark.extra_info["group"] = group
+
+    fields = [
+        "type",
+        "created_at",
+        "public",
+        "id",
+        "actor/id",
+        "actor/login",
+        "actor/url",
+        "actor/avatar_url",
+        "repo/id",
+        "repo/name",
+        "repo/url",
+    ]
+    events = libpy_simdjson_loads((JSON_FIXTURES_DIR / "github_events.json").read_bytes())
+    pointers = [
+        Pointer(f"/{i}/{field}") for i in range(len(events)) for field in fields
+    ]
+
+    if group == "at_pointer":
+        benchmark(lambda: tuple(events.at_pointer(p) for p in pointers))
+    else:
+        benchmark(events.extract, pointers)
+
+
 @pytest.mark.parametrize(
     ["group", "read_func"],
     [
@@ -131,3 +478,130 @@ def test_benchmark_list_access(group, read_func, benchmark):
         content = f.read()
         doc = read_func(content)
         benchmark(bench_func, doc)
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("n_threads", [1, 2, 4, 8])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "canada.json",
+        JSON_FIXTURES_DIR / "twitter.json",
+    ],
+)
+def test_benchmark_threaded_load(n_threads, path, benchmark):
+    benchmark.group = f"Threaded load {path}"
+    benchmark.extra_info["n_threads"] = n_threads
+
+    with path.open('rb') as f:
+        content = f.read()
+
+    # Each thread owns its own parser and drops its result before the next parse, so
+    # the only shared resource is the GIL, which is released while parsing.
+    docs_per_thread = 16
+    parsers = [LibpySimdjsonParser() for _ in range(n_threads)]
+
+    def worker(parser):
+        for _ in range(docs_per_thread):
+            parser.loads(content)
+
+    with ThreadPoolExecutor(n_threads) as executor:
+        def run():
+            list(executor.map(worker, parsers))
+
+        benchmark(run)
+
+
+# Run in a fresh interpreter so that the peak RSS belongs to one document alone.
+MEMORY_PROBE = """
+import gc
+import json
+import resource
+import sys
+import tracemalloc
+from pathlib import Path
+
+import libpy_simdjson
+
+path, mode = Path(sys.argv[1]), sys.argv[2]
+
+
+def load(parser):
+    doc = parser.load(path)
+    if mode == "materialized":
+        if isinstance(doc, libpy_simdjson.Object):
+            return doc.as_dict()
+        return doc.as_list()
+    return doc
+
+
+def peak_rss():
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # bytes on macOS, kilobytes elsewhere
+    return rss if sys.platform == "darwin" else rss * 1024
+
+
+parser = libpy_simdjson.Parser(collect_stats=True)
+gc.collect()
+rss_before = peak_rss()
+blocks_before = sys.getallocatedblocks()
+doc = load(parser)
+result = {
+    "peak_rss_bytes": peak_rss() - rss_before,
+    "python_blocks": sys.getallocatedblocks() - blocks_before,
+    "tape_bytes": parser.stats()["tape_words"] * 8,
+    "string_bytes": parser.stats()["string_bytes"],
+    **parser.memory_usage(),
+}
+del doc
+gc.collect()
+result["retained_bytes"] = parser.memory_usage()["retained_bytes"]
+
+# tracing slows allocation and grows the heap, so it gets a run of its own
+tracemalloc.start()
+doc = load(parser)
+result["python_peak_bytes"] = tracemalloc.get_traced_memory()[1]
+tracemalloc.stop()
+
+json.dump(result, sys.stdout)
+"""
+
+
+@pytest.mark.slow
+@pytest.mark.parametrize("group", ["proxy", "materialized"])
+@pytest.mark.parametrize(
+    "path",
+    [
+        JSON_FIXTURES_DIR / "canada.json",
+        JSON_FIXTURES_DIR / "twitter.json",
+        JSON_FIXTURES_DIR / "github_events.json",
+        JSON_FIXTURES_DIR / "citm_catalog.json",
+        JSON_FIXTURES_DIR / "mesh.json",
+    ],
+)
+def test_benchmark_memory(group, path, benchmark):
+    benchmark.group = f"Memory {path}"
+    benchmark.extra_info["group"] = group
+
+    def probe():
+        out = subprocess.run(
+            [sys.executable, "-c", MEMORY_PROBE, str(path), group],
+            check=True,
+            capture_output=True,
+        )
+        return json_loads(out.stdout)
+
+    # the time is of a whole interpreter; the memory figures are what matter here
+    result = benchmark.pedantic(probe, rounds=1, iterations=1)
+    benchmark.extra_info.update(result)
+
+    size = path.stat().st_size
+    assert result["tape_bytes"] <= result["document_bytes"]
+    assert result["string_bytes"] <= result["document_bytes"]
+    # stage 1 indexes, a document to parse into and one spare: about 24 bytes per
+    # input byte, plus stage 2's stacks
+    assert result["retained_bytes"] <= 24 * size + 64 * 1024
+    if group == "proxy":
+        # the result refers to the tape instead of copying it into Python objects
+        assert result["python_blocks"] < 100
+        assert result["live_document_bytes"] == result["document_bytes"]
@@ -0,0 +1,95 @@
+import json
+from pathlib import Path
+
+import pytest
+
+import libpy_simdjson as simdjson
+
+JSON_FIXTURES_DIR = Path(__file__).parent / "jsonexamples"
+
+
+@pytest.mark.parametrize(
+    "test_path",
+    list(JSON_FIXTURES_DIR.glob("**/*.json")),
+)
+def test_dumps_round_trip(test_path):
+    content = test_path.read_bytes()
+    dumped = simdjson.loads(content).dumps()
+    assert isinstance(dumped, bytes)
+    assert json.loads(dumped) == json.loads(content)
+    assert simdjson.loads(dumped).dumps() == dumped
+
+
+def test_dumps_minified():
+    doc = simdjson.loads(b' { "a" : [ 1 , -2 , 3.5 , true , false , null ] , "b" : { } } ')
+    assert doc.dumps() == b'{"a":[1,-2,3.5,true,false,null],"b":{}}'
+    assert doc[b"a"].dumps() == b"[1,-2,3.5,true,false,null]"
+    assert doc[b"b"].dumps() == b"{}"
+    assert doc.at_pointer(b"/a").dumps() == b"[1,-2,3.5,true,false,null]"
+
+
+def test_dumps_escapes():
+    text = 'quote " backslash \\ controls \x00\x1f\n\t\r\b\f unicode é\U0001f600 '
+    text = text * 4  # long enough to take the block scan
+    doc = simdjson.loads(json.dumps([text], ensure_ascii=False).encode())
+    dumped = doc.dumps()
+    assert json.loads(dumped) == [text]
+    assert simdjson.dumps([text]) == dumped
+
+
+def test_dumps_python_objects():
+    assert simdjson.dumps(None) == b"null"
+    assert simdjson.dumps(
+        {"a": [1, -2, 2 ** 64, 0.5, True, False, None], b"b": ("c", b"d")}
+    ) == b'{"a":[1,-2,18446744073709551616,0.5,true,false,null],"b":["c","d"]}'
+    assert simdjson.dumps(["\u00e9".encode()]) == b'["\xc3\xa9"]'
+
+    doc = simdjson.loads(b'{"x": [1, {"y": "z"}]}')
+    assert simdjson.dumps({"doc": doc, "x": doc[b"x"]}) == (
+        b'{"doc":{"x":[1,{"y":"z"}]},"x":[1,{"y":"z"}]}'
+    )
+
+
+def test_dumps_invalid():
+    with pytest.raises(TypeError):
+        simdjson.dumps(object())
+    with pytest.raises(TypeError):
+        simdjson.dumps({1: 2})
+    with pytest.raises(ValueError):
+        simdjson.dumps([float("nan")])
+    with pytest.raises(ValueError):
+        simdjson.dumps(b"\xff")
+    with pytest.raises(ValueError):
+        simdjson.dumps({b"\xc3": 1})
+
+    cycle = []
+    cycle.append(cycle)
+    with pytest.raises(RecursionError):
+        simdjson.dumps(cycle)
+
+
+@pytest.mark.parametrize("name", ["mesh.pretty.json", "tree-pretty.json", "twitter.json"])
+def test_minify(name):
+    content = (JSON_FIXTURES_DIR / name).read_bytes()
+    minified = simdjson.minify(content)
+    assert isinstance(minified, bytes)
+    assert len(minified) <= len(content)
+    assert json.loads(minified) == json.loads(content)
+    assert simdjson.minify(minified) == minified
+
+    assert simdjson.minify(content.decode()) == minified
+    assert simdjson.minify(simdjson.PaddedBuffer(content)) == minified
+
+    out = bytearray(len(content))
+    written = simdjson.minify(memoryview(content), out=out)
+    assert out[:written] == minified
+
+
+def test_minify_invalid():
+    assert simdjson.minify(b' { "a b" : [ 1 , 2 ] } ') == b'{"a b":[1,2]}'
+    with pytest.raises(ValueError):
+        simdjson.minify(b'{"a": "never closed}')
+    with pytest.raises(ValueError):
+        simdjson.minify(b"[1, 2]", out=bytearray(3))
+    with pytest.raises(BufferError):
+        simdjson.minify(b"[1, 2]", out=b"      ")
@@ -1,3 +1,7 @@
+import json
+import os
+import re
+import threading
 from pathlib import Path
 
 import pytest
@@ -13,3 +17,464 @@ JSON_FIXTURES_DIR = Path(__file__).parent / "jsonexamples"
 )
 def test_load_file(test_path):
     simdjson.load(test_path)
+
+
+def test_load_threaded():
+    from concurrent.futures import ThreadPoolExecutor
+
+    path = JSON_FIXTURES_DIR / "twitter.json"
+    content = path.read_bytes()
+    expected = simdjson.loads(content)
+
+    def worker(_):
+        parser = simdjson.Parser()
+        return all(parser.loads(content) == expected for _ in range(8))
+
+    with ThreadPoolExecutor(4) as executor:
+        assert all(executor.map(worker, range(4)))
+
+
+@pytest.mark.parametrize(
+    "wrap",
+    [
+        bytes,
+        bytearray,
+        memoryview,
+        lambda content: content.decode(),
+        simdjson.PaddedBuffer,
+    ],
+)
+def test_loads_buffer(wrap):
+    content = (JSON_FIXTURES_DIR / "small/smalldemo.json").read_bytes()
+    expected = simdjson.loads(content)
+    assert simdjson.loads(wrap(content)) == expected
+    assert simdjson.Parser().loads(wrap(content)) == expected
+
+
+def test_loads_mmap():
+    import mmap
+
+    path = JSON_FIXTURES_DIR / "small/smalldemo.json"
+    with path.open("rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+        assert simdjson.loads(m) == simdjson.loads(path.read_bytes())
+
+
+def test_padded_buffer_reuse():
+    content = (JSON_FIXTURES_DIR / "small/smalllist.json").read_bytes()
+    buf = simdjson.PaddedBuffer(content)
+    assert len(buf) == len(content)
+
+    parser = simdjson.Parser()
+    for _ in range(3):
+        assert parser.loads(buf).as_list() == json.loads(content)
+
+
+def test_reload_same_path(tmp_path):
+    path = tmp_path / "doc.json"
+    parser = simdjson.Parser()
+
+    path.write_bytes(b'{"a": 1}')
+    assert parser.load(path, keep_mapped=True)[b"a"] == 1
+    assert parser.memory_usage()["mapped_bytes"] == 8
+    assert parser.load(path, keep_mapped=True)[b"a"] == 1
+
+    # rewriting the file must not reuse the stale mapping
+    path.write_bytes(b'{"a": 22}')
+    assert parser.load(path, keep_mapped=True)[b"a"] == 22
+
+    # by default the file is unmapped once it has been parsed
+    assert parser.load(path)[b"a"] == 22
+    assert parser.memory_usage()["mapped_bytes"] == 0
+
+
+@pytest.mark.skipif(not hasattr(os, "mkfifo"), reason="requires named pipes")
+def test_load_pipe(tmp_path):
+    path = tmp_path / "pipe"
+    os.mkfifo(path)
+    content = (JSON_FIXTURES_DIR / "twitter.json").read_bytes()
+
+    # opening either end of a pipe blocks until the other end is opened
+    writer = threading.Thread(target=path.write_bytes, args=(content,))
+    writer.start()
+    try:
+        doc = simdjson.Parser().load(path)
+    finally:
+        writer.join()
+    assert doc == simdjson.loads(content)
+
+
+def test_shrink_default_parsers():
+    simdjson.loads(b"[1]")
+
+    parsed = threading.Event()
+    done = threading.Event()
+
+    def worker():
+        simdjson.loads(b"[2]")
+        parsed.set()
+        done.wait()
+
+    thread = threading.Thread(target=worker)
+    thread.start()
+    try:
+        parsed.wait()
+        # this thread's parser and the idle worker's
+        assert simdjson.shrink_default_parsers() >= 2
+    finally:
+        done.set()
+        thread.join()
+
+    # the parsers are still usable afterwards
+    assert simdjson.loads(b"[3]").as_list() == [3]
+    assert simdjson.load(JSON_FIXTURES_DIR / "twitter.json") == simdjson.loads(
+        (JSON_FIXTURES_DIR / "twitter.json").read_bytes()
+    )
+    assert simdjson.shrink_default_parsers() >= 1
+
+
+def test_reparse_with_live_results():
+    parser = simdjson.Parser()
+    first = parser.loads(b'{"a": [1, 2, 3]}')
+    inner = first[b"a"]
+    second = parser.loads(b'{"b": "x"}')
+    third = parser.loads(b"[4, 5]")
+
+    # earlier results keep their own document
+    assert first.as_dict() == {b"a": [1, 2, 3]}
+    assert inner.as_list() == [1, 2, 3]
+    assert second.as_dict() == {b"b": b"x"}
+    assert third.as_list() == [4, 5]
+
+    del first, inner
+    assert parser.loads(b"[6]").as_list() == [6]
+
+
+def test_parser_capacity():
+    content = (JSON_FIXTURES_DIR / "twitter.json").read_bytes()
+
+    parser = simdjson.Parser(capacity=len(content), max_depth=64)
+    assert parser.capacity() == len(content)
+    assert parser.max_depth() == 64
+    doc = parser.loads(content)
+    assert parser.capacity() == len(content)
+
+    parser.shrink()
+    assert parser.capacity() == 0
+    assert doc == simdjson.loads(content)
+    assert parser.loads(b"[1, 2]").as_list() == [1, 2]
+    assert 0 < parser.capacity() < len(content)
+
+    parser.allocate(1 << 20)
+    assert parser.capacity() == 1 << 20
+    assert parser.max_depth() == 64
+    parser.shrink(capacity=1024)
+    assert parser.capacity() == 1024
+
+
+MEMORY_KEYS = {
+    "capacity",
+    "parser_bytes",
+    "document_bytes",
+    "spare_bytes",
+    "retained_bytes",
+    "live_document_bytes",
+    "mapped_bytes",
+}
+
+
+def test_parser_memory_usage():
+    path = JSON_FIXTURES_DIR / "twitter.json"
+    size = path.stat().st_size
+
+    parser = simdjson.Parser()
+    assert parser.memory_usage() == dict.fromkeys(MEMORY_KEYS, 0)
+
+    doc = parser.load(path)
+    usage = parser.memory_usage()
+    assert set(usage) == MEMORY_KEYS
+    assert usage["capacity"] == size
+    assert usage["mapped_bytes"] == 0
+    # a tape word per input byte and 5 string buffer bytes per 3 input bytes
+    assert 9 * size < usage["document_bytes"] < 10 * size
+    assert 4 * size < usage["parser_bytes"] < 5 * size
+    # ``doc`` holds the buffers it was parsed into; the parser has new ones
+    assert usage["live_document_bytes"] == usage["document_bytes"]
+    assert usage["spare_bytes"] == 0
+    assert usage["retained_bytes"] == usage["parser_bytes"] + usage["document_bytes"]
+
+    del doc
+    usage = parser.memory_usage()
+    assert usage["live_document_bytes"] == 0
+    assert usage["spare_bytes"] == usage["document_bytes"]
+    assert usage["retained_bytes"] == (
+        usage["parser_bytes"] + usage["document_bytes"] + usage["spare_bytes"]
+    )
+
+    # a document much smaller than the capacity is copied into buffers sized to fit
+    small = parser.loads(b'{"a": [1, "bc"]}')
+    assert 0 < parser.memory_usage()["live_document_bytes"] < 1024
+    assert parser.memory_usage()["spare_bytes"] == usage["spare_bytes"]
+    del small
+
+    parser.shrink()
+    usage = parser.memory_usage()
+    assert usage["capacity"] == 0
+    assert usage["spare_bytes"] == 0
+    assert usage["mapped_bytes"] == 0
+    # only stage 2's stacks and an empty document are left
+    assert usage["retained_bytes"] < 16 * 1024
+
+
+def test_parser_limits():
+    shallow = simdjson.Parser(max_depth=3)
+    assert shallow.loads(b"[[1]]").as_list() == [[1]]
+    with pytest.raises(ValueError):
+        shallow.loads(b"[[[1]]]")
+
+    small = simdjson.Parser(max_capacity=16)
+    assert small.max_capacity() == 16
+    assert small.loads(b"[1, 2, 3]").as_list() == [1, 2, 3]
+    with pytest.raises(ValueError):
+        small.loads(b"[" + b"1, " * 16 + b"1]")
+    with pytest.raises(ValueError):
+        small.allocate(17)
+    with pytest.raises(ValueError):
+        simdjson.Parser(capacity=17, max_capacity=16)
+    with pytest.raises(ValueError):
+        simdjson.Parser(max_depth=0)
+
+
+def test_module_loads_with_live_results():
+    # the module level functions share a parser per thread
+    first = simdjson.loads(b'{"a": [1, 2, 3]}')
+    decoded = simdjson.loads(b'{"a": "b"}', decode_strings=True)
+    big = simdjson.load(JSON_FIXTURES_DIR / "twitter.json")
+    second = simdjson.loads(b"[4, 5]")
+
+    assert first.as_dict() == {b"a": [1, 2, 3]}
+    assert decoded.as_dict() == {"a": "b"}
+    assert big == simdjson.Parser().load(JSON_FIXTURES_DIR / "twitter.json")
+    assert second.as_list() == [4, 5]
+    assert simdjson.loads(b'"x"', decode_strings=True) == "x"
+    assert simdjson.loads(b'"x"') == b"x"
+
+    with pytest.raises(ValueError):
+        simdjson.loads(b"[1")
+    assert simdjson.loads(b"[6]").as_list() == [6]
+
+
+STAT_KEYS = {
+    "documents",
+    "bytes",
+    "structural_indexes",
+    "tape_words",
+    "string_bytes",
+    "copy_ns",
+    "stage1_ns",
+    "stage2_ns",
+    "convert_ns",
+}
+
+
+def test_parser_stats():
+    parser = simdjson.Parser()
+    parser.loads(b"[1, 2, 3]")
+    assert parser.stats() == dict.fromkeys(STAT_KEYS, 0)
+
+    parser = simdjson.Parser(collect_stats=True)
+    doc = parser.loads(b'{"a": "bc", "d": [1, 2.5]}')
+    doc.as_dict()
+    stats = parser.stats()
+    assert set(stats) == STAT_KEYS
+    assert stats["documents"] == 1
+    assert stats["bytes"] == 26
+    assert stats["structural_indexes"] == 13
+    # root, {, "a", "bc", "d", [, 1 and its value, 2.5 and its value, ], }, root
+    assert stats["tape_words"] == 13
+    # each string is a 4 byte length, the bytes and a NUL
+    assert stats["string_bytes"] == 6 + 7 + 6
+    assert stats["stage1_ns"] > 0
+    assert stats["stage2_ns"] > 0
+    assert stats["convert_ns"] > 0
+
+    with pytest.raises(ValueError):
+        parser.loads(b"[1")
+    parser.load(JSON_FIXTURES_DIR / "twitter.json")
+    stats = parser.stats()
+    assert stats["documents"] == 2
+    assert stats["bytes"] == 26 + (JSON_FIXTURES_DIR / "twitter.json").stat().st_size
+
+    parser.reset_stats()
+    assert parser.stats() == dict.fromkeys(STAT_KEYS, 0)
+
+
+@pytest.mark.skipif(
+    not Path("/proc/self/maps").exists(), reason="requires /proc/self/maps"
+)
+def test_module_load_unmaps(tmp_path):
+    path = tmp_path / "doc.json"
+    path.write_bytes(b'{"a": 1}')
+    doc = simdjson.load(path)
+    # the thread's default parser outlives the call but must not pin the file
+    assert str(path) not in Path("/proc/self/maps").read_text()
+    path.unlink()
+    assert doc[b"a"] == 1
+
+
+def test_module_stats():
+    previous = simdjson.collect_stats(True)
+    try:
+        simdjson.reset_stats()
+        simdjson.loads(b"[1, 2, 3]")
+        simdjson.Parser(collect_stats=True).loads(b"[4]")
+        simdjson.Parser().loads(b"[5]")
+        stats = simdjson.stats()
+        assert set(stats) == STAT_KEYS
+        assert stats["documents"] == 2
+        assert stats["bytes"] == 9 + 3
+
+        assert simdjson.collect_stats(False)
+        simdjson.loads(b"[1, 2, 3]")
+        assert simdjson.stats()["documents"] == 2
+
+        simdjson.reset_stats()
+        assert simdjson.stats() == dict.fromkeys(STAT_KEYS, 0)
+    finally:
+        simdjson.collect_stats(previous)
+
+
+def test_implementations():
+    names = simdjson.implementations()
+    assert "fallback" in names
+    active = simdjson.active_implementation()
+    assert active in names
+
+    parser = simdjson.Parser(capacity=1 << 16, max_depth=64)
+    # the kernel is bound when the parser allocates, before its first parse
+    assert parser.implementation() == active
+    expected = parser.load(JSON_FIXTURES_DIR / "twitter.json").as_dict()
+    assert parser.implementation() == active
+    try:
+        for name in names:
+            previous = parser.implementation()
+            simdjson.set_implementation(name)
+            assert simdjson.active_implementation() == name
+            assert parser.implementation() == previous
+            # existing parsers switch at their next parse, keeping their limits
+            assert parser.load(JSON_FIXTURES_DIR / "twitter.json") == expected
+            assert parser.implementation() == name
+            assert parser.capacity() >= 1 << 16
+            assert parser.max_depth() == 64
+            assert simdjson.loads(b"[1, 2]").as_list() == [1, 2]
+            assert simdjson.validate(b'[1, "2"]') == (None, None, None)
+            assert simdjson.validate(b"[1, tru]")[0] == "T_ATOM_ERROR"
+    finally:
+        assert simdjson.set_implementation(active) == names[-1]
+
+    with pytest.raises(ValueError):
+        simdjson.set_implementation("not a kernel")
+    assert simdjson.active_implementation() == active
+
+
+def test_load_missing_file(tmp_path):
+    with pytest.raises(ValueError):
+        simdjson.load(tmp_path / "missing.json")
+
+
+@pytest.mark.parametrize("size", [None, 1, 3])
+def test_parser_pool_load_all(size):
+    pool = simdjson.ParserPool() if size is None else simdjson.ParserPool(size=size)
+    paths = sorted(JSON_FIXTURES_DIR.glob("*.json")) * 2
+    docs = pool.load_all(paths)
+    assert len(docs) == len(paths)
+    for path, doc in zip(paths, docs):
+        assert doc == simdjson.load(path)
+
+    # the pool's parsers are free again even though the results are still alive
+    assert pool.load_all(paths[:2]) == docs[:2]
+
+
+def test_parser_pool_loads_all():
+    pool = simdjson.ParserPool(size=2)
+    contents = [
+        (JSON_FIXTURES_DIR / "small/smalldemo.json").read_bytes(),
+        b"[1, 2, 3]",
+        b'"scalar"',
+        bytearray(b'{"a": null}'),
+    ]
+    docs = pool.loads_all(contents)
+    assert docs[0].as_dict() == simdjson.loads(contents[0]).as_dict()
+    assert docs[1].as_list() == [1, 2, 3]
+    assert docs[2] == b"scalar"
+    assert docs[3].as_dict() == {b"a": None}
+
+
+def test_parser_pool_errors(tmp_path):
+    pool = simdjson.ParserPool(size=2)
+    with pytest.raises(ValueError):
+        pool.loads_all([b"[1]", b"[1"])
+    with pytest.raises(ValueError):
+        pool.load_all([tmp_path / "missing.json"])
+
+
+@pytest.mark.parametrize(
+    "test_path",
+    list(JSON_FIXTURES_DIR.glob("*.json")),
+)
+def test_validate_file(test_path):
+    content = test_path.read_bytes()
+    assert simdjson.validate(content) == (None, None, None)
+    assert simdjson.validate(content, structural_only=True) == (None, None, None)
+
+
+@pytest.mark.parametrize(
+    ["content", "code", "offset"],
+    [
+        (b"[1,]", "TAPE_ERROR", None),
+        (b'{"a": 1,}', "TAPE_ERROR", None),
+        (b"[1 2]", "TAPE_ERROR", None),
+        (b'{"a" 1}', "TAPE_ERROR", None),
+        (b"[tru]", "T_ATOM_ERROR", None),
+        (b"[1.]", "NUMBER_ERROR", None),
+        (b'["\\x"]', "STRING_ERROR", None),
+        (b"18446744073709551616", "NUMBER_ERROR", None),
+        (b"[[]", "TAPE_ERROR", None),
+        # simdjson reports where content after a whole document starts
+        (b"[1]]", "TAPE_ERROR", 3),
+        (b"1 2", "TAPE_ERROR", 2),
+    ],
+)
+def test_validate_invalid(content, code, offset):
+    actual_code, message, actual_offset = simdjson.validate(content)
+    assert actual_code == code
+    assert actual_offset == offset
+    with pytest.raises(ValueError, match=re.escape(message)):
+        simdjson.loads(content)
+
+
+def test_validate_structural_only():
+    # stage 1 does not check the grammar
+    assert simdjson.validate(b"[1,]", structural_only=True) == (None, None, None)
+    for content, code in [
+        (b'["never closed]', "UNCLOSED_STRING"),
+        (b'["\xff"]', "UTF8_ERROR"),
+        (b"   ", "EMPTY"),
+    ]:
+        result = simdjson.validate(content, structural_only=True)
+        assert result[0] == code
+        assert result[2] is None
+        assert simdjson.validate(content) == result
+
+
+def test_parser_validate():
+    parser = simdjson.Parser()
+    doc = parser.loads(b'{"a": [1, 2]}')
+    assert parser.validate(b"[1, 2]") == (None, None, None)
+    assert parser.validate(b"[1, 2")[0] == "TAPE_ERROR"
+    assert parser.validate(bytearray(b"[1,]"), structural_only=True) == (
+        None,
+        None,
+        None,
+    )
+    # validating does not disturb earlier results
+    assert doc.as_dict() == {b"a": [1, 2]}
@@ -0,0 +1,88 @@
+import json
+import subprocess
+from pathlib import Path
+
+import pytest
+
+from libpy_simdjson.benchmark import EXECUTABLE, main
+
+# skipped with LIBPY_SIMDJSON_NATIVE_BENCHMARK=0, or if it failed to build
+pytestmark = pytest.mark.skipif(
+    not EXECUTABLE.exists(), reason="the native benchmarks were not built"
+)
+
+JSON_FIXTURES_DIR = Path(__file__).parent / "jsonexamples"
+
+
+def native_benchmark(*args):
+    return subprocess.run(
+        [str(EXECUTABLE)] + [str(arg) for arg in args],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        universal_newlines=True,
+    )
+
+
+def operations():
+    if not EXECUTABLE.exists():
+        return []
+    result = native_benchmark("--list-operations")
+    assert result.returncode == 0
+    return result.stdout.split()
+
+
+@pytest.mark.parametrize("operation", operations())
+def test_native_benchmark_run(operation):
+    path = JSON_FIXTURES_DIR / "twitter.json"
+    result = native_benchmark(
+        "--json", "--min-time", 0, "--operation", operation, path
+    )
+    assert result.returncode == 0, result.stderr
+    lines = result.stdout.splitlines()
+    if operation == "scalars:uint64":
+        # twitter.json has no integers of 2 ** 63 or more
+        assert lines == []
+        return
+
+    [line] = lines
+    result = json.loads(line)
+    assert result["file"] == str(path)
+    assert result["operation"] == operation
+    assert result["items"] > 0
+    assert result["iterations"] >= 1
+    assert result["seconds"] > 0
+    assert result["gb_per_s"] > 0
+    assert result["ns_per_item"] > 0
+    assert result["cxx_allocations"] >= 0
+    if operation in {"parse", "at_pointer", "eq", "hash", "scalars:bool", "scalars:null"}:
+        # these never build new Python objects
+        assert result["python_allocations"] == 0
+    elif operation not in {"count", "index"}:
+        assert result["python_allocations"] > 0
+    if operation in {"parse", "eq", "hash"}:
+        # these reuse the tape and buffers allocated when warming up
+        assert result["cxx_allocations"] == 0
+
+
+def test_native_benchmark_errors(tmp_path):
+    path = JSON_FIXTURES_DIR / "twitter.json"
+    result = native_benchmark("--operation", "not an operation", path)
+    assert result.returncode == 2
+    assert "unknown operation" in result.stderr
+
+    result = native_benchmark("--implementation", "not an implementation", path)
+    assert result.returncode == 2
+
+    bad = tmp_path / "bad.json"
+    bad.write_bytes(b"[1, 2")
+    result = native_benchmark("--operation", "parse", bad)
+    assert result.returncode == 1
+    assert str(bad) in result.stderr
+
+
+def test_native_benchmark_main(capfd):
+    path = JSON_FIXTURES_DIR / "twitter.json"
+    assert main(["--min-time", "0", "--operation", "parse", path]) == 0
+    lines = capfd.readouterr().out.splitlines()
+    assert len(lines) == 2
+    assert lines[1].split()[:2] == ["twitter.json", "parse"]
@@ -1,5 +1,8 @@
+import json
 from pathlib import Path
 
+import pytest
+
 import libpy_simdjson as simdjson
 
 
@@ -11,6 +14,28 @@ def test_as_dict(object_element, py_object_element):
     assert actual_dict == py_object_element
 
 
+def test_materialize(object_element, py_object_element):
+    assert object_element.materialize() == py_object_element
+    assert object_element.materialize(depth=10) == py_object_element
+
+    shallow = object_element.materialize(depth=1)
+    assert isinstance(shallow, dict)
+    assert shallow.keys() == py_object_element.keys()
+    assert isinstance(shallow[b"Thumbnail"], simdjson.Object)
+    assert isinstance(shallow[b"array"], simdjson.Array)
+    assert shallow[b"Thumbnail"].as_dict() == py_object_element[b"Thumbnail"]
+    assert shallow[b"array"].as_list() == py_object_element[b"array"]
+    assert shallow[b"Width"] == 800
+
+    assert isinstance(object_element.materialize(depth=0), simdjson.Object)
+
+    doc = simdjson.loads(b'{"a": {"b": {"c": ["d"]}}}')
+    nested = doc.materialize(depth=2)
+    assert isinstance(nested[b"a"], dict)
+    assert isinstance(nested[b"a"][b"b"], simdjson.Object)
+    assert nested[b"a"][b"b"].as_dict() == {b"c": [b"d"]}
+
+
 def test_keys(object_element, py_object_element):
     keys = object_element.keys()
     assert keys == [
@@ -53,8 +78,88 @@ def test_items(object_element, py_object_element):
         assert cpp == py
 
 
+def test_shared_keys():
+    records = simdjson.loads(b'[{"id": 1, "name": "a"}, {"id": 2, "name": "b"}]')
+    first, second = records.as_list()
+    assert first == {b"id": 1, b"name": b"a"}
+    assert second == {b"id": 2, b"name": b"b"}
+    # repeated keys within one conversion share a single object
+    for a, b in zip(first, second):
+        assert a is b
+
+    doc = simdjson.loads(b'{"outer": {"outer": 1}}')
+    keys = [k for k, _ in doc.items()] + list(doc[b"outer"].keys())
+    assert keys == [b"outer", b"outer"]
+
+
+def test_hash():
+    first = simdjson.loads(b'{"id": 1, "tags": ["a", "b"], "score": -0.0}')
+    second = simdjson.loads(b'{"id": 1, "tags": ["a", "b"], "score": 0.0}')
+    assert first == second
+    assert hash(first) == hash(second)
+    assert first.digest() == second.digest()
+    assert 0 <= first.digest() < 2 ** 64
+
+    # the hash ignores key order even though == does not
+    reordered = simdjson.loads(b'{"score": 0.0, "tags": ["a", "b"], "id": 1}')
+    assert reordered != first
+    assert hash(reordered) == hash(first)
+
+    other = simdjson.loads(b'{"id": 1, "tags": ["b", "a"], "score": 0.0}')
+    assert hash(other) != hash(first)
+
+    records = simdjson.loads(b'[{"a": 1}, {"a": 2}, {"a": 1}, {"a": 1.0}]')
+    assert len(set(records)) == 2
+    assert {records[0]: "first"}[records[2]] == "first"
+    assert {records[0]: "first"}[records[3]] == "first"
+
+
+@pytest.mark.parametrize(
+    ["lhs", "rhs", "equal"],
+    [
+        (b"1", b"1.0", True),
+        (b"-3", b"-3e0", True),
+        (b"0", b"-0.0", True),
+        (b"18446744073709551615", b"1.8446744073709552e19", False),
+        (b"9223372036854775808", b"9223372036854775808.0", True),
+        (b"9007199254740993", b"9007199254740992.0", False),
+        (b"1", b"1.5", False),
+        (b"1", b"true", False),
+    ],
+)
+def test_hash_numbers(lhs, rhs, equal):
+    # ``==`` compares numbers by value in either order, and equal values hash equally
+    a = simdjson.loads(b'{"a": %s}' % lhs)
+    b = simdjson.loads(b'{"a": %s}' % rhs)
+    assert (a == b) is equal
+    assert (b == a) is equal
+    if equal:
+        assert hash(a) == hash(b)
+        assert len({a, b}) == len({b, a}) == 1
+
+
 def test_mapping(object_element):
     assert object_element[b"Width"] == 800
+    assert object_element["Width"] == 800
+
+
+def test_decode_strings():
+    content = '{"ascii": "abc", "utf8": "\u00e9t\u00e9 \u2603", "nested": [{"k": ""}]}'
+    expected = json.loads(content)
+
+    doc = simdjson.loads(content.encode(), decode_strings=True)
+    assert doc.as_dict() == expected
+    assert doc.keys() == list(expected)
+    assert list(doc) == list(expected)
+    assert doc.values() == list(expected.values())
+    assert doc.items() == list(expected.items())
+    assert doc["utf8"] == expected["utf8"]
+    assert doc.at_pointer(b"/nested/0/k") == ""
+    assert list(doc["nested"]) == expected["nested"]
+
+    parser = simdjson.Parser(decode_strings=True)
+    assert parser.loads(b'"caf\xc3\xa9"') == "caf\u00e9"
+    assert simdjson.Parser().loads(b'"caf\xc3\xa9"') == "caf\u00e9".encode()
 
 
 def test_at(object_element):
@@ -63,6 +168,85 @@ def test_at(object_element):
     assert object_element.at_pointer(b"/array/0") == 116
 
 
+def test_compiled_pointer(object_element):
+    pointer = simdjson.Pointer(b"/Thumbnail/Width")
+    assert len(pointer) == 2
+    assert object_element.at_pointer(pointer) == 100
+    assert object_element.at_pointer("/Thumbnail/Width") == 100
+    assert object_element.at_pointer(simdjson.Pointer("/array/2")) == 234
+    assert isinstance(object_element.at_pointer(simdjson.Pointer("")), simdjson.Object)
+
+    doc = simdjson.loads(b'{"a/b": {"~c": [10, 20]}, "": 1}')
+    assert doc.at_pointer(simdjson.Pointer(b"/a~1b/~0c/1")) == 20
+    assert doc.at_pointer(simdjson.Pointer(b"/")) == 1
+
+    for missing in [b"/nope", b"/array/3", b"/array/-", b"/array/01", b"/Width/0"]:
+        with pytest.raises(KeyError):
+            object_element.at_pointer(simdjson.Pointer(missing))
+        with pytest.raises(KeyError):
+            object_element.at_pointer(missing)
+
+    for invalid in [b"Width", b"/a~2", b"/a~"]:
+        with pytest.raises(ValueError):
+            simdjson.Pointer(invalid)
+
+
+def test_wide_object_lookup():
+    expected = {f"key{i}".encode(): i for i in range(500)}
+    content = json.dumps({k.decode(): v for k, v in expected.items()}).encode()
+    doc = simdjson.loads(content)
+    # repeated lookups switch to a hash index partway through
+    for _ in range(5):
+        for key, value in expected.items():
+            assert doc[key] == value
+            assert doc[key.decode()] == value
+
+    plugins = simdjson.load(JSON_FIXTURES_DIR / "update-center.json")[b"plugins"]
+    py_plugins = json.loads((JSON_FIXTURES_DIR / "update-center.json").read_bytes())
+    for _ in range(5):
+        for name in py_plugins["plugins"]:
+            assert plugins[name][b"name"].decode() == name
+
+
+def test_wide_object_duplicate_keys():
+    members = ", ".join(f'"k{i}": {i}' for i in range(100))
+    doc = simdjson.loads(f'{{"dup": "first", {members}, "dup": "second"}}'.encode())
+    for _ in range(10):
+        assert doc[b"dup"] == b"first"
+
+
+def test_extract(object_element):
+    width = simdjson.Pointer(b"/Thumbnail/Width")
+    assert object_element.extract(
+        [b"/Width", width, "/Thumbnail/Url", b"/array/2", b"/array/0", b"/Width"]
+    ) == (800, 100, b"http://ex.com/th.png", 234, 116, 800)
+    assert object_element.extract([]) == ()
+
+    (root,) = object_element.extract([b""])
+    assert isinstance(root, simdjson.Object)
+
+    assert object_element.extract([b"/nope", b"/array/9"], default=None) == (None, None)
+    with pytest.raises(KeyError):
+        object_element.extract([b"/Width", b"/Thumbnail/nope"])
+    with pytest.raises(ValueError):
+        object_element.extract([b"/a~2"])
+
+
+def test_extract_matches_at_pointer():
+    content = (JSON_FIXTURES_DIR / "github_events.json").read_bytes()
+    events = simdjson.loads(content)
+    pointers = [
+        b"/0/type",
+        b"/0/actor/login",
+        b"/0/repo/name",
+        b"/29/id",
+        b"/3/payload",
+        b"/1/actor/id",
+    ]
+    expected = tuple(events.at_pointer(p) for p in pointers)
+    assert events.extract(pointers) == expected
+
+
 def get_new_object_element(object_element):
     return object_element
 
@@ -0,0 +1,88 @@
+import json
+from pathlib import Path
+
+import pytest
+
+import libpy_simdjson as simdjson
+
+
+JSON_FIXTURES_DIR = Path(__file__).parent / "jsonexamples"
+NDJSON_PATH = JSON_FIXTURES_DIR / "amazon_cellphones.ndjson"
+
+
+@pytest.fixture
+def py_documents():
+    with NDJSON_PATH.open() as f:
+        return [json.loads(line) for line in f]
+
+
+def test_load_many(py_documents):
+    parser = simdjson.Parser()
+    actual = [doc.as_list() for doc in parser.load_many(NDJSON_PATH)]
+    assert len(actual) == len(py_documents)
+    assert actual[5][0] == py_documents[5][0].encode()
+
+
+@pytest.mark.parametrize("wrap", [bytes, bytearray, simdjson.PaddedBuffer])
+@pytest.mark.parametrize("batch_size", [None, 4096])
+def test_parse_many(wrap, batch_size, py_documents):
+    content = NDJSON_PATH.read_bytes()
+    parser = simdjson.Parser()
+    if batch_size is None:
+        stream = parser.parse_many(wrap(content))
+    else:
+        stream = parser.parse_many(wrap(content), batch_size=batch_size)
+
+    lengths = [len(doc) for doc in stream]
+    assert lengths == [len(doc) for doc in py_documents]
+
+
+def as_py_obj(doc):
+    if isinstance(doc, simdjson.Array):
+        return doc.as_list()
+    elif isinstance(doc, simdjson.Object):
+        return doc.as_dict()
+    return doc
+
+
+def test_parse_many_scalars():
+    parser = simdjson.Parser()
+    docs = parser.parse_many(b'1 "a" [2] {"b": null}\n3')
+    assert [as_py_obj(doc) for doc in docs] == [1, b"a", [2], {b"b": None}, 3]
+
+
+def test_parse_many_keeps_documents():
+    parser = simdjson.Parser()
+    docs = list(parser.parse_many(b'[1] {"a": [2]} [3]'))
+    assert docs[0].as_list() == [1]
+    assert docs[1].as_dict() == {b"a": [2]}
+    assert docs[2].as_list() == [3]
+
+
+def test_parse_many_documents_fit():
+    parser = simdjson.Parser()
+    docs = list(parser.parse_many(b'[1] {"a": [2]} [3]'))
+    usage = parser.memory_usage()
+    assert usage["capacity"] >= 1 << 20
+    # each kept document is copied out of the batch sized buffers
+    assert 0 < usage["live_document_bytes"] < 1024 * len(docs)
+    assert usage["spare_bytes"] == 0
+
+
+def test_parse_many_invalid():
+    parser = simdjson.Parser()
+    with pytest.raises(ValueError):
+        for doc in parser.parse_many(b'[1] {"a" 1}'):
+            pass
+
+
+def test_parse_during_stream():
+    parser = simdjson.Parser()
+    stream = iter(parser.parse_many(b"[1] [2]"))
+    next(stream)
+    with pytest.raises(ValueError):
+        parser.loads(b"[3]")
+
+    assert [doc.as_list() for doc in stream] == [[2]]
+    # an exhausted stream releases the parser
+    assert parser.loads(b"[3]").as_list() == [3]
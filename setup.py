@@ -2,9 +2,13 @@ import ast
 import glob
 import os
 import sys
+import sysconfig
+from distutils.errors import CompileError, LinkError
 
+import libpy
 from libpy.build import LibpyExtension
 from setuptools import find_packages, setup
+from setuptools.command.build_ext import build_ext
 
 if ast.literal_eval(os.environ.get("LIBPY_SIMDJSON_DEBUG_BUILD", "0")):
     optlevel = 0
@@ -15,9 +19,19 @@ else:
     debug_symbols = False
     max_errors = None
 
+# the C++ benchmarks link the objects built for the extension, so they are cheap to
+# build; LIBPY_SIMDJSON_NATIVE_BENCHMARK=0 skips them
+native_benchmark = ast.literal_eval(
+    os.environ.get("LIBPY_SIMDJSON_NATIVE_BENCHMARK", "1")
+)
+
 
 def extension(*args, **kwargs):
-    extra_compile_args = ["-DLIBPY_AUTOCLASS_UNSAFE_API"]
+    extra_compile_args = [
+        "-DLIBPY_AUTOCLASS_UNSAFE_API",
+        # run stage 1 of the next batch on a helper thread in parse_many/load_many
+        "-DSIMDJSON_THREADS_ENABLED",
+    ]
     if sys.platform == "darwin":
         extra_compile_args.append("-mmacosx-version-min=10.15")
 
@@ -36,6 +50,89 @@ def extension(*args, **kwargs):
     )
 
 
+ext_modules = [
+    extension(
+        "libpy_simdjson.parser",
+        [
+            "libpy_simdjson/parser.cc",
+            "libpy_simdjson/core.cc",
+            "libpy_simdjson/simdjson.cpp",
+        ],
+    ),
+]
+
+
+class build_ext_with_native_benchmark(build_ext):
+    """Build the extensions, then the ``native_benchmark`` executable next to
+    ``libpy_simdjson.parser``, linked from the objects compiled for it.
+
+    The benchmarks are optional: if they fail to build, this warns and goes on.
+    """
+
+    core_sources = ["libpy_simdjson/core.cc", "libpy_simdjson/simdjson.cpp"]
+
+    def run(self):
+        super().run()
+        if not native_benchmark:
+            return
+        try:
+            self.build_native_benchmark()
+        except (CompileError, LinkError) as e:
+            self.warn(f"not building the native benchmarks: {e}")
+
+    def build_native_benchmark(self):
+        ext = self.ext_map["libpy_simdjson.parser"]
+        objects = self.compiler.compile(
+            ["libpy_simdjson/native_benchmark.cc"],
+            output_dir=self.build_temp,
+            macros=ext.define_macros,
+            include_dirs=ext.include_dirs,
+            debug=self.debug,
+            extra_postargs=ext.extra_compile_args,
+            depends=ext.depends,
+        )
+        objects += self.compiler.object_filenames(
+            self.core_sources,
+            output_dir=self.build_temp,
+        )
+
+        # the executable embeds the interpreter to build Python objects
+        python_lib_dirs = [
+            d
+            for d in {sysconfig.get_config_var(v) for v in ("LIBDIR", "LIBPL")}
+            if d
+        ]
+        libraries = ext.libraries + [
+            "python" + sysconfig.get_config_var("LDVERSION")
+        ]
+        library_dirs = ext.library_dirs + python_lib_dirs
+        runtime_library_dirs = ext.runtime_library_dirs + python_lib_dirs
+        extra_postargs = ext.extra_link_args + (
+            sysconfig.get_config_var("LIBS") or ""
+        ).split()
+
+        # extensions find libpy's library through ``import libpy``; the executable
+        # links it directly
+        libpy_dir = os.path.dirname(libpy.__file__)
+        libpy_library = glob.glob(os.path.join(libpy_dir, "libpy*.so*"))
+        if libpy_library:
+            objects += libpy_library[:1]
+            runtime_library_dirs.append(libpy_dir)
+
+        self.compiler.link_executable(
+            objects,
+            os.path.join(
+                os.path.dirname(self.get_ext_fullpath(ext.name)),
+                "native_benchmark",
+            ),
+            libraries=libraries,
+            library_dirs=library_dirs,
+            runtime_library_dirs=runtime_library_dirs,
+            extra_postargs=extra_postargs,
+            debug=self.debug,
+            target_lang="c++",
+        )
+
 install_requires = [
     "setuptools",
     "libpy",
@@ -83,10 +180,6 @@ setup(
             "ujson",
         ],
     },
-    ext_modules=[
-        extension(
-            "libpy_simdjson.parser",
-            ["libpy_simdjson/parser.cc", "libpy_simdjson/simdjson.cpp"],
-        ),
-    ],
+    ext_modules=ext_modules,
+    cmdclass={"build_ext": build_ext_with_native_benchmark},
 )